@@ -14,6 +14,8 @@ typedef struct base_allocation {
 static base_allocation* allocs;
 static size_t nallocs;
 static size_t alloc_capacity;
+static size_t* addr_index;      // open-addressed; `allocs` index + 1, 0 is empty
+static size_t addr_index_capacity;
 static size_t* frees;
 static size_t nfrees;
 static size_t free_capacity;
@@ -27,6 +29,26 @@ static unsigned alloc_random(void) {
 
 static void base_alloc_atexit(void);
 
+// Addresses in `allocs` are never handed back to the system allocator
+// before exit, so each is unique and `addr_index` needs no deletion.
+static size_t addr_index_slot(void* ptr) {
+    size_t i = ((uintptr_t) ptr * 0x9E3779B97F4A7C15ULL) >> 17;
+    while (addr_index[i & (addr_index_capacity - 1)]
+           && allocs[addr_index[i & (addr_index_capacity - 1)] - 1].ptr != ptr)
+        ++i;
+    return i & (addr_index_capacity - 1);
+}
+
+static void addr_index_grow(void) {
+    free(addr_index);
+    addr_index_capacity = addr_index_capacity ? addr_index_capacity * 2 : 128;
+    addr_index = calloc(addr_index_capacity, sizeof(size_t));
+    if (!addr_index)
+        abort();
+    for (size_t i = 0; i < nallocs; ++i)
+        addr_index[addr_index_slot(allocs[i].ptr)] = i + 1;
+}
+
 void* base_malloc(size_t sz) {
     if (disabled)
         return malloc(sz);
@@ -56,8 +78,11 @@ void* base_malloc(size_t sz) {
         if (!allocs)
             abort();
     }
+    if (2 * (nallocs + 1) > addr_index_capacity)
+        addr_index_grow();
     void* ptr = malloc(sz);
     if (ptr) {
+        addr_index[addr_index_slot(ptr)] = nallocs + 1;
         allocs[nallocs].ptr = ptr;
         allocs[nallocs].sz = sz;
         ++nallocs;
@@ -76,13 +101,12 @@ void base_free(void* ptr) {
         if (!frees)
             abort();
     }
-    for (size_t i = 0; i < nallocs; ++i)
-        if (allocs[i].ptr == ptr) {
-            frees[nfrees] = i;
-            ++nfrees;
-            return;
-        }
-    // if we get here, invalid free; silently ignore it
+    size_t i = addr_index_capacity ? addr_index[addr_index_slot(ptr)] : 0;
+    if (i) {
+        frees[nfrees] = i - 1;
+        ++nfrees;
+    }
+    // otherwise, invalid free; silently ignore it
 }
 
 void base_disablealloc(int d) {
@@ -93,5 +117,6 @@ static void base_alloc_atexit(void) {
     for (size_t i = 0; i < nfrees; ++i)
         free(allocs[frees[i]].ptr);
     free(frees);
+    free(addr_index);
     free(allocs);
 }
@@ -0,0 +1,540 @@
+#include <malloc.h>
+#include "m61.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+// bench61: Measure m61 malloc/free throughput on the base allocator and
+// on the size-class allocator, using workloads shaped like the tests.
+// With -m, measure m61's memory overhead per block instead; with -c,
+// compare m61 with the system allocator on synthetic workloads.
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// test003-test006: ten blocks of 1-10 bytes, then free them
+static void w_small(unsigned long long npairs) {
+    void* ptrs[10];
+    for (unsigned long long n = 0; n < npairs; n += 10) {
+        for (int i = 0; i < 10; ++i)
+            ptrs[i] = malloc(i + 1);
+        for (int i = 0; i < 10; ++i)
+            free(ptrs[i]);
+    }
+}
+
+// test021: one 40-byte block at a time
+static void w_fixed(unsigned long long npairs) {
+    for (unsigned long long n = 0; n < npairs; ++n) {
+        int* ptr = (int*) malloc(sizeof(int) * 10);
+        ptr[0] = n;
+        free(ptr);
+    }
+}
+
+// test027: build a 400-node linked list, then free it
+typedef struct node {
+    struct node* next;
+} node;
+
+static void w_list(unsigned long long npairs) {
+    for (unsigned long long n = 0; n < npairs; n += 400) {
+        node* list = NULL;
+        for (int i = 0; i < 400; ++i) {
+            node* x = (node*) malloc(sizeof(node));
+            x->next = list;
+            list = x;
+        }
+        while (list) {
+            node* x = list;
+            list = x->next;
+            free(x);
+        }
+    }
+}
+
+// test012/test013: grow a buffer by realloc, 16 bytes at a time
+static void w_realloc(unsigned long long npairs) {
+    for (unsigned long long n = 0; n < npairs; n += 64) {
+        char* p = NULL;
+        for (int i = 1; i <= 64; ++i) {
+            p = (char*) realloc(p, i * 16);
+            p[i * 16 - 1] = 0;
+        }
+        free(p);
+    }
+}
+
+// batches of 1024 large sparse arrays from calloc, 16-256 KiB, of which
+// only one byte each is used. These blocks come from guard pages, whose
+// fresh or dropped spans m61's calloc need not clear.
+static void w_calloc(unsigned long long npairs) {
+    char* ptrs[1024];
+    guard_setthreshold(16384);
+    for (unsigned long long n = 0; n < npairs; n += 1024) {
+        for (int i = 0; i < 1024; ++i) {
+            ptrs[i] = (char*) calloc(1, 16384 + ((n + i) * 2654435761U) % 245761);
+            ptrs[i][0] = 1;
+        }
+        for (int i = 0; i < 1024; ++i)
+            free(ptrs[i]);
+    }
+    guard_setthreshold(0);
+}
+
+static struct workload {
+    const char* name;
+    void (*run)(unsigned long long);
+} workloads[] = {
+    {"small", w_small}, {"fixed", w_fixed}, {"list", w_list},
+    {"realloc", w_realloc}, {"calloc", w_calloc}
+};
+#define NWORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+// Print the system-allocator bytes used per live block of `sz` bytes,
+// through m61 (header, tail canary and index included) and directly.
+static void memory_overhead(size_t sz, unsigned long long count) {
+    void** ptrs = (void**) malloc(count * sizeof(void*));
+    size_t used[2];
+    for (int direct = 0; direct < 2; ++direct) {
+        size_t before = mallinfo2().uordblks;
+        for (unsigned long long i = 0; i < count; ++i)
+            ptrs[i] = direct ? base_malloc(sz) : malloc(sz);
+        used[direct] = mallinfo2().uordblks - before;
+        for (unsigned long long i = 0; i < count; ++i)
+            if (direct)
+                base_free(ptrs[i]);
+            else
+                free(ptrs[i]);
+    }
+    printf("%-10zu %15.1f %15.1f %15.1f\n", sz, (double) used[0] / count,
+           (double) used[1] / count, (double) (used[0] - used[1]) / count);
+    free(ptrs);
+}
+
+
+// Comparison with the system allocator (-c).
+//    Each of these workloads runs in its own child process, once on the
+//    system allocator and once on m61, so peak RSS can be measured.
+//    Every malloc, free and realloc is timed; latencies go in a
+//    histogram with 8 buckets per power of two (about 12% resolution)
+//    and include the cost of reading the clock.
+
+#define LAT_NBUCKETS 320
+
+typedef struct bench_result {
+    double elapsed;             // wall-clock seconds
+    unsigned long long nops;
+    unsigned long long lat[LAT_NBUCKETS];
+} bench_result;
+
+typedef struct bench_allocator {
+    const char* name;
+    void* (*malloc_fn)(size_t);
+    void (*free_fn)(void*);
+    void* (*realloc_fn)(void*, size_t);
+} bench_allocator;
+
+static void* bench_m61_malloc(size_t sz) {
+    return m61_malloc(sz, __FILE__, __LINE__);
+}
+static void bench_m61_free(void* ptr) {
+    m61_free(ptr, __FILE__, __LINE__);
+}
+static void* bench_m61_realloc(void* ptr, size_t sz) {
+    return m61_realloc(ptr, sz, __FILE__, __LINE__);
+}
+
+static const bench_allocator bench_allocators[] = {
+    {"system", malloc, free, realloc},
+    {"m61", bench_m61_malloc, bench_m61_free, bench_m61_realloc}
+};
+
+static inline unsigned long long nsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline unsigned lat_bucket(unsigned long long ns) {
+    if (ns < 8)
+        return ns;
+    unsigned e = 63 - __builtin_clzll(ns);
+    unsigned b = 8 * (e - 2) + ((ns >> (e - 3)) & 7);
+    return b < LAT_NBUCKETS ? b : LAT_NBUCKETS - 1;
+}
+
+static unsigned long long lat_bucket_min(unsigned b) {
+    if (b < 8)
+        return b;
+    return (8ULL + b % 8) << (b / 8 - 1);
+}
+
+// Return the latency below which fraction `p` of operations fall.
+static unsigned long long lat_percentile(const bench_result* r, double p) {
+    unsigned long long want = p * r->nops, seen = 0;
+    for (unsigned b = 0; b < LAT_NBUCKETS; ++b) {
+        seen += r->lat[b];
+        if (seen > want)
+            return lat_bucket_min(b);
+    }
+    return lat_bucket_min(LAT_NBUCKETS - 1);
+}
+
+// Timed allocator calls; each adds one operation to `r`.
+static inline void* t_malloc(const bench_allocator* a, bench_result* r, size_t sz) {
+    unsigned long long t = nsec();
+    void* ptr = a->malloc_fn(sz);
+    ++r->lat[lat_bucket(nsec() - t)];
+    ++r->nops;
+    return ptr;
+}
+
+static inline void t_free(const bench_allocator* a, bench_result* r, void* ptr) {
+    unsigned long long t = nsec();
+    a->free_fn(ptr);
+    ++r->lat[lat_bucket(nsec() - t)];
+    ++r->nops;
+}
+
+static inline void* t_realloc(const bench_allocator* a, bench_result* r,
+                              void* ptr, size_t sz) {
+    unsigned long long t = nsec();
+    void* new_ptr = a->realloc_fn(ptr, sz);
+    ++r->lat[lat_bucket(nsec() - t)];
+    ++r->nops;
+    return new_ptr;
+}
+
+static inline uint64_t bench_random(uint64_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+#define BENCH_NSLOTS 1024
+
+// Fill or empty a random slot of a working set of BENCH_NSLOTS blocks,
+// with sizes from `pick_size`, for `nops` operations.
+static void slot_churn(const bench_allocator* a, bench_result* r,
+                       unsigned long long nops, size_t (*pick_size)(uint64_t*)) {
+    char* slots[BENCH_NSLOTS] = {NULL};
+    uint64_t rs = 88172645463325252ULL;
+    while (r->nops < nops) {
+        unsigned i = bench_random(&rs) % BENCH_NSLOTS;
+        if (slots[i]) {
+            t_free(a, r, slots[i]);
+            slots[i] = NULL;
+        } else {
+            size_t sz = pick_size(&rs);
+            slots[i] = t_malloc(a, r, sz);
+            slots[i][sz - 1] = 1;
+        }
+    }
+    for (unsigned i = 0; i < BENCH_NSLOTS; ++i)
+        if (slots[i])
+            t_free(a, r, slots[i]);
+}
+
+static size_t uniform_size(uint64_t* rs) {
+    return 1 + bench_random(rs) % 256;
+}
+
+// Pareto sizes with shape 1.2, at least 16 bytes and at most 1 MiB:
+// mostly small blocks, with a heavy tail of large ones.
+static size_t powerlaw_size(uint64_t* rs) {
+    double u = (bench_random(rs) >> 11) * 0x1.0p-53 + 0x1.0p-54;
+    double sz = 16 * pow(u, -1 / 1.2);
+    return sz < (1 << 20) ? (size_t) sz : (1 << 20);
+}
+
+// uniform: 1-256 byte blocks in a working set of 1024
+static void c_uniform(const bench_allocator* a, bench_result* r,
+                      unsigned long long nops) {
+    slot_churn(a, r, nops, uniform_size);
+}
+
+// powerlaw: power-law sized blocks in a working set of 1024
+static void c_powerlaw(const bench_allocator* a, bench_result* r,
+                       unsigned long long nops) {
+    slot_churn(a, r, nops, powerlaw_size);
+}
+
+// growth: grow buffers by half again with realloc, from 16 bytes to
+// 1 MiB, then free them
+static void c_growth(const bench_allocator* a, bench_result* r,
+                     unsigned long long nops) {
+    while (r->nops < nops) {
+        char* p = NULL;
+        for (size_t sz = 16; sz <= (1 << 20); sz += sz / 2) {
+            p = t_realloc(a, r, p, sz);
+            p[sz - 1] = 1;
+        }
+        t_free(a, r, p);
+    }
+}
+
+// hhtest: hhtest's sizes at its default skew (each size equally likely),
+// each block freed right away
+static void c_hhtest(const bench_allocator* a, bench_result* r,
+                     unsigned long long nops) {
+    static const size_t hh_sizes[40] = {
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        1, 1, 1, 1, 2, 4, 8, 16, 32, 64,
+        128, 256, 512, 1024, 2048, 4096, 8192, 16384, 32768, 65536
+    };
+    uint64_t rs = 88172645463325252ULL;
+    while (r->nops < nops) {
+        char* p = t_malloc(a, r, hh_sizes[bench_random(&rs) % 40]);
+        p[0] = 1;
+        t_free(a, r, p);
+    }
+}
+
+// prodcons: one thread allocates 16-512 byte blocks and passes them
+// through a queue to another thread, which frees them
+#define PC_QUEUESIZE 4096
+
+typedef struct prodcons {
+    const bench_allocator* a;
+    bench_result r;
+    unsigned long long nblocks;
+    void* queue[PC_QUEUESIZE];
+    unsigned long long head;    // written by producer
+    unsigned long long tail;    // written by consumer
+} prodcons;
+
+static void* pc_consumer(void* arg) {
+    prodcons* pc = arg;
+    for (unsigned long long n = 0; n < pc->nblocks; ++n) {
+        while (__atomic_load_n(&pc->head, __ATOMIC_ACQUIRE) == n)
+            sched_yield();
+        t_free(pc->a, &pc->r, pc->queue[n % PC_QUEUESIZE]);
+        __atomic_store_n(&pc->tail, n + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static void c_prodcons(const bench_allocator* a, bench_result* r,
+                       unsigned long long nops) {
+    prodcons* pc = calloc(1, sizeof(prodcons));
+    pc->a = a;
+    pc->nblocks = (nops + 1) / 2;
+    pthread_t consumer;
+    pthread_create(&consumer, NULL, pc_consumer, pc);
+    uint64_t rs = 88172645463325252ULL;
+    for (unsigned long long n = 0; n < pc->nblocks; ++n) {
+        while (n - __atomic_load_n(&pc->tail, __ATOMIC_ACQUIRE) == PC_QUEUESIZE)
+            sched_yield();
+        size_t sz = 16 + bench_random(&rs) % 497;
+        char* p = t_malloc(a, r, sz);
+        p[sz - 1] = 1;
+        pc->queue[n % PC_QUEUESIZE] = p;
+        __atomic_store_n(&pc->head, n + 1, __ATOMIC_RELEASE);
+    }
+    pthread_join(consumer, NULL);
+    r->nops += pc->r.nops;
+    for (unsigned b = 0; b < LAT_NBUCKETS; ++b)
+        r->lat[b] += pc->r.lat[b];
+    free(pc);
+}
+
+// threads: BENCH_NTHREADS threads, each churning its own working set of
+// 1-256 byte blocks, as in uniform
+#define BENCH_NTHREADS 4
+
+typedef struct churner {
+    const bench_allocator* a;
+    bench_result r;
+    unsigned long long nops;
+} churner;
+
+static void* churn_thread(void* arg) {
+    churner* ch = arg;
+    slot_churn(ch->a, &ch->r, ch->nops, uniform_size);
+    return NULL;
+}
+
+static void c_threads(const bench_allocator* a, bench_result* r,
+                      unsigned long long nops) {
+    churner* ch = calloc(BENCH_NTHREADS, sizeof(churner));
+    pthread_t t[BENCH_NTHREADS];
+    for (int i = 0; i < BENCH_NTHREADS; ++i) {
+        ch[i].a = a;
+        ch[i].nops = nops / BENCH_NTHREADS;
+        pthread_create(&t[i], NULL, churn_thread, &ch[i]);
+    }
+    for (int i = 0; i < BENCH_NTHREADS; ++i) {
+        pthread_join(t[i], NULL);
+        r->nops += ch[i].r.nops;
+        for (unsigned b = 0; b < LAT_NBUCKETS; ++b)
+            r->lat[b] += ch[i].r.lat[b];
+    }
+    free(ch);
+}
+
+static struct compare_workload {
+    const char* name;
+    void (*run)(const bench_allocator*, bench_result*, unsigned long long);
+} compare_workloads[] = {
+    {"uniform", c_uniform}, {"powerlaw", c_powerlaw}, {"prodcons", c_prodcons},
+    {"threads", c_threads}, {"growth", c_growth}, {"hhtest", c_hhtest}
+};
+#define NCOMPARE (sizeof(compare_workloads) / sizeof(compare_workloads[0]))
+
+// Run workload `w` for `nops` operations on allocator `a` in a child
+// process. Fills in `r` and sets `*maxrss` to the child's peak RSS in
+// KiB; returns 0 on failure.
+static int compare_run(const struct compare_workload* w, const bench_allocator* a,
+                       int slab, unsigned long long nops,
+                       bench_result* r, long* maxrss) {
+    int pfd[2];
+    if (pipe(pfd) != 0)
+        return 0;
+    fflush(stdout);
+    pid_t p = fork();
+    if (p == 0) {
+        close(pfd[0]);
+        // the base allocator's free is a linear scan, so put m61 on the
+        // system allocator (or the size-class allocator with -s)
+        base_disablealloc(1);
+        slab_enablealloc(slab);
+        bench_result* cr = calloc(1, sizeof(bench_result));
+        double start = now();
+        w->run(a, cr, nops);
+        cr->elapsed = now() - start;
+        const char* buf = (const char*) cr;
+        size_t n = 0;
+        while (n < sizeof(*cr)) {
+            ssize_t x = write(pfd[1], buf + n, sizeof(*cr) - n);
+            if (x <= 0)
+                _exit(1);
+            n += x;
+        }
+        _exit(0);
+    }
+    close(pfd[1]);
+    size_t n = 0;
+    while (n < sizeof(*r)) {
+        ssize_t x = read(pfd[0], (char*) r + n, sizeof(*r) - n);
+        if (x <= 0)
+            break;
+        n += x;
+    }
+    close(pfd[0]);
+    int status;
+    struct rusage ru;
+    if (p < 0 || wait4(p, &status, 0, &ru) != p)
+        return 0;
+    *maxrss = ru.ru_maxrss;
+    return n == sizeof(*r) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void compare(int argc, char** argv) {
+    int slab = 0;
+    if (argc > 0 && strcmp(argv[0], "-s") == 0) {
+        slab = 1;
+        --argc, ++argv;
+    }
+    unsigned long long nops = argc > 0 ? strtoull(argv[0], 0, 0) : 1000000;
+
+    printf("%-9s %-7s %12s %8s %8s %8s %8s %12s\n", "workload", "alloc",
+           "ops/s", "p50 ns", "p90 ns", "p99 ns", "p99.9 ns", "peak RSS KiB");
+    for (size_t w = 0; w < NCOMPARE; ++w) {
+        int selected = argc <= 1;
+        for (int i = 1; i < argc; ++i)
+            selected = selected || strcmp(argv[i], compare_workloads[w].name) == 0;
+        if (!selected)
+            continue;
+
+        for (size_t ai = 0; ai < 2; ++ai) {
+            bench_result r;
+            long maxrss;
+            if (!compare_run(&compare_workloads[w], &bench_allocators[ai],
+                             slab, nops, &r, &maxrss)) {
+                fprintf(stderr, "%s on %s failed\n", compare_workloads[w].name,
+                        bench_allocators[ai].name);
+                exit(1);
+            }
+            printf("%-9s %-7s %12.0f %8llu %8llu %8llu %8llu %12ld\n",
+                   compare_workloads[w].name, bench_allocators[ai].name,
+                   r.nops / r.elapsed, lat_percentile(&r, 0.5),
+                   lat_percentile(&r, 0.9), lat_percentile(&r, 0.99),
+                   lat_percentile(&r, 0.999), maxrss);
+        }
+    }
+}
+
+
+int main(int argc, char** argv) {
+    if (argc > 1 && (strcmp(argv[1], "-h") == 0
+                     || strcmp(argv[1], "--help") == 0)) {
+        printf("Usage: ./bench61 [COUNT [WORKLOAD...]]\n\
+       OR ./bench61 -m [COUNT]\n\
+       OR ./bench61 -c [-s] [NOPS [WORKLOAD...]]\n\
+\n\
+  Runs each WORKLOAD (default all: small fixed list realloc calloc)\n\
+  for COUNT malloc/free pairs (default 50000), first on the base\n\
+  allocator and then on the size-class allocator, and prints pairs\n\
+  per second.\n\
+\n\
+  With -m, allocates COUNT blocks of several sizes and prints the heap\n\
+  bytes used per block with and without m61.\n\
+\n\
+  With -c, runs each WORKLOAD (default all: uniform powerlaw prodcons\n\
+  threads growth hhtest) for NOPS allocator calls (default 1000000) on the\n\
+  system allocator and on m61, each in a fresh process, and prints\n\
+  calls per second, latency percentiles and peak RSS. -s puts m61 on\n\
+  the size-class allocator.\n");
+        exit(0);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        compare(argc - 2, argv + 2);
+        exit(0);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "-m") == 0) {
+        unsigned long long count = argc > 2 ? strtoull(argv[2], 0, 0) : 100000;
+        base_disablealloc(1);
+        printf("m61 header: %zu bytes\n", sizeof(struct m61_statistics_metadata));
+        printf("%-10s %15s %15s %15s\n", "size", "m61 bytes", "system bytes", "overhead");
+        for (size_t sz = 16; sz <= 256; sz *= 2)
+            memory_overhead(sz, count);
+        exit(0);
+    }
+
+    unsigned long long count = 50000;
+    if (argc > 1)
+        count = strtoull(argv[1], 0, 0);
+
+    printf("%-10s %15s %15s %8s\n", "workload", "base pairs/s", "slab pairs/s", "speedup");
+    for (size_t w = 0; w < NWORKLOADS; ++w) {
+        int selected = argc <= 2;
+        for (int i = 2; i < argc; ++i)
+            selected = selected || strcmp(argv[i], workloads[w].name) == 0;
+        if (!selected)
+            continue;
+
+        double rate[2];
+        for (int slab = 0; slab < 2; ++slab) {
+            slab_enablealloc(slab);
+            double start = now();
+            workloads[w].run(count);
+            rate[slab] = count / (now() - start);
+        }
+        printf("%-10s %15.0f %15.0f %7.1fx\n", workloads[w].name,
+               rate[0], rate[1], rate[1] / rate[0]);
+    }
+}
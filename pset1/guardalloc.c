@@ -0,0 +1,210 @@
+#define M61_DISABLE 1
+#include "m61.h"
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+
+// This file contains a guard-page allocator that m61 can use for large
+// blocks, so that writes past the end of a block fault immediately
+// instead of being caught at free time.
+//
+// Each block gets a span of whole pages followed by an inaccessible
+// guard page, and is placed so it ends at most 15 bytes before the
+// guard (payloads stay 16-byte aligned). Spans come from one reserved
+// PROT_NONE arena; making a new span's pages accessible costs one
+// mprotect. Freed spans are recycled: they stay accessible and wait on
+// a free list for their page count, so a later block of similar size
+// needs no system call. Once more than GUARD_CACHEBYTES of freed spans
+// are cached, further spans are also given back to the kernel with
+// madvise, and are known to be zero when reused, as new spans are.
+// guard_free's caller can name one address, the freed block's header,
+// whose page is kept resident so its free mark can still be read; that
+// page is cleared when the span is reused.
+// Metadata lives out of line: `page_span` records, for the
+// page holding each block's first byte, the span's first page and page
+// count. Each guard page's record is marked GUARD_PAGE, so
+// guard_readable can tell memory that would fault from spans, which
+// stay accessible once made so.
+
+#define GUARD_ARENASIZE     ((size_t) 1 << 34)
+#define GUARD_NLISTS        256     // free lists for 1..255-page spans
+#define GUARD_CACHEBYTES    ((size_t) 64 << 20)
+#define GUARD_ZEROED        0x80000000U     // free list flag: span is zero
+#define GUARD_PAGE          0xFFFFFFFFU     // page_span first: a guard page
+
+typedef struct guard_span {
+    uint32_t first;             // first page of span
+    uint32_t npages;            // # accessible pages (guard excluded)
+    uint32_t kept;              // free span: 1 + page kept resident, or 0
+} guard_span;
+
+typedef struct guard_list {
+    uint32_t* pages;            // first pages of free spans, | GUARD_ZEROED
+    size_t n;
+    size_t capacity;
+} guard_list;
+
+static char* arena;
+static char* arena_next;
+static size_t pagesize;
+static guard_span* page_span;
+static guard_list frees[GUARD_NLISTS];  // frees[0]: spans of 256+ pages
+static size_t cached_bytes;
+static size_t threshold;
+static pthread_mutex_t guard_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int guard_init(void) {
+    pagesize = sysconf(_SC_PAGESIZE);
+    void* a = mmap(NULL, GUARD_ARENASIZE, PROT_NONE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    void* s = mmap(NULL, GUARD_ARENASIZE / pagesize * sizeof(guard_span),
+                   PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (a == MAP_FAILED || s == MAP_FAILED) {
+        if (a != MAP_FAILED)
+            munmap(a, GUARD_ARENASIZE);
+        threshold = 0;
+        return 0;
+    }
+    page_span = s;
+    arena_next = a;
+    __atomic_store_n(&arena, (char*) a, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static inline int guard_owns(const void* ptr) {
+    return __atomic_load_n(&arena, __ATOMIC_ACQUIRE) && (const char*) ptr >= arena
+        && (const char*) ptr < arena + GUARD_ARENASIZE;
+}
+
+// Take a free span of `npages` pages off its free list and return its
+// address, or NULL if there is none. Sets `*zeroed` if the span's
+// contents were dropped.
+static char* guard_reuse(size_t npages, int* zeroed) {
+    guard_list* l = &frees[npages < GUARD_NLISTS ? npages : 0];
+    for (size_t i = l->n; i-- > 0; ) {
+        uint32_t first = l->pages[i] & ~GUARD_ZEROED;
+        if (npages < GUARD_NLISTS || page_span[first].npages == npages) {
+            *zeroed = (l->pages[i] & GUARD_ZEROED) != 0;
+            if (*zeroed && page_span[first].kept)
+                memset(arena + (size_t) (first + page_span[first].kept - 1) * pagesize,
+                       0, pagesize);
+            l->pages[i] = l->pages[--l->n];
+            cached_bytes -= npages * pagesize;
+            return arena + (size_t) first * pagesize;
+        }
+    }
+    return NULL;
+}
+
+void* guard_malloc(size_t sz, int* zeroed) {
+    if (!threshold || sz < threshold || sz > GUARD_ARENASIZE / 2)
+        return NULL;
+    pthread_mutex_lock(&guard_lock);
+    if (!arena && !guard_init()) {
+        pthread_mutex_unlock(&guard_lock);
+        return NULL;
+    }
+    size_t npages = (sz + 15 + pagesize - 1) / pagesize;
+    char* span = guard_reuse(npages, zeroed);
+    if (!span) {
+        *zeroed = 1;
+        span = arena_next;
+        if ((size_t) (arena + GUARD_ARENASIZE - span) < (npages + 1) * pagesize
+            || mprotect(span, npages * pagesize, PROT_READ | PROT_WRITE) != 0) {
+            pthread_mutex_unlock(&guard_lock);
+            return NULL;
+        }
+        page_span[(span - arena) / pagesize + npages].first = GUARD_PAGE;
+        // guard_readable reads `arena_next` without the lock
+        __atomic_store_n(&arena_next, arena_next + (npages + 1) * pagesize,
+                         __ATOMIC_RELEASE);
+    }
+
+    char* ptr = (char*) (((uintptr_t) span + npages * pagesize - sz) & ~(uintptr_t) 15);
+    guard_span* gs = &page_span[(ptr - arena) / pagesize];
+    gs->first = (span - arena) / pagesize;
+    gs->npages = npages;
+    gs->kept = 0;
+    pthread_mutex_unlock(&guard_lock);
+    return ptr;
+}
+
+// Drop the contents of pages [first, first + npages). Returns 0 on
+// success.
+static int guard_drop(size_t first, size_t npages) {
+    return npages ? madvise(arena + first * pagesize, npages * pagesize,
+                            MADV_DONTNEED) : 0;
+}
+
+int guard_free(void* ptr, const void* keep) {
+    if (!guard_owns(ptr))
+        return 0;
+    pthread_mutex_lock(&guard_lock);
+    guard_span gs = page_span[((char*) ptr - arena) / pagesize];
+    size_t kept = gs.npages;    // offset of kept page, or npages if none
+    if (keep && (const char*) keep >= arena + (size_t) gs.first * pagesize
+        && (const char*) keep < arena + (size_t) (gs.first + gs.npages) * pagesize)
+        kept = ((const char*) keep - arena) / pagesize - gs.first;
+    gs.kept = 0;
+    page_span[gs.first] = gs;   // guard_reuse looks up large spans here
+    guard_list* l = &frees[gs.npages < GUARD_NLISTS ? gs.npages : 0];
+    if (l->n == l->capacity) {
+        l->capacity = l->capacity ? l->capacity * 2 : 16;
+        l->pages = realloc(l->pages, l->capacity * sizeof(uint32_t));
+        if (!l->pages)
+            abort();
+    }
+    cached_bytes += gs.npages * pagesize;
+    uint32_t entry = gs.first;
+    if (cached_bytes > GUARD_CACHEBYTES
+        // drop the contents, except `keep`'s page; the span stays mapped
+        && guard_drop(gs.first, kept) == 0
+        && guard_drop(gs.first + kept + 1,
+                      gs.npages - (kept < gs.npages ? kept + 1 : kept)) == 0) {
+        entry |= GUARD_ZEROED;
+        page_span[gs.first].kept = kept < gs.npages ? kept + 1 : 0;
+    }
+    l->pages[l->n++] = entry;
+    pthread_mutex_unlock(&guard_lock);
+    return 1;
+}
+
+size_t guard_usable_size(void* ptr) {
+    if (!guard_owns(ptr))
+        return 0;
+    guard_span gs = page_span[((char*) ptr - arena) / pagesize];
+    return arena + (size_t) (gs.first + gs.npages) * pagesize - (char*) ptr;
+}
+
+/// guard_readable(ptr, len)
+///    Return 0 if reading [ptr, ptr + len) would touch a guard page or
+///    unused arena memory, 1 otherwise (including for memory outside
+///    the guard arena). Takes no lock: pages below `arena_next` never
+///    change between span and guard page.
+
+int guard_readable(const void* ptr, size_t len) {
+    const char* first = ptr;
+    const char* last = first + (len ? len - 1 : 0);
+    if (!guard_owns(first) && !guard_owns(last))
+        return 1;
+    int ok = first >= arena && last < __atomic_load_n(&arena_next, __ATOMIC_ACQUIRE);
+    for (size_t pg = (first - arena) / pagesize;
+         ok && pg <= (size_t) (last - arena) / pagesize; ++pg)
+        ok = page_span[pg].first != GUARD_PAGE;
+    return ok;
+}
+
+void guard_setthreshold(size_t min_size) {
+    threshold = min_size;
+}
+
+void guard_forklock(int lock) {
+    if (lock)
+        pthread_mutex_lock(&guard_lock);
+    else
+        pthread_mutex_unlock(&guard_lock);
+}
@@ -130,4 +130,7 @@ int main(int argc, char **argv) {
 
         phase(skew, count);
     }
+
+    m61_printstatistics();
+    m61_printheavyreport();
 }
@@ -1,10 +1,23 @@
+#define _GNU_SOURCE 1
 #define M61_DISABLE 1
 #include "m61.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <stddef.h>
 #include <assert.h>
+#include <pthread.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <malloc.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
 
 typedef struct m61_statistics stats_struct;
 typedef struct m61_statistics_metadata stats_meta;
@@ -13,154 +26,1786 @@ typedef struct m61_tail {
 } m61_tail;
 
 
-static stats_struct stats_global = {0, 0, 0, 0, 0, 0, 0, 0 };
+// Statistics.
+//    Counters are sharded per thread so concurrent allocations do not
+//    fight over one cache line; m61_getstatistics sums the shards. A shard
+//    may be shared once there are more than M61_NSHARDS threads, so the
+//    counters are updated with (uncontended) atomic adds. nactive and
+//    active_size can wrap in one shard, but the sums are exact.
+//
+//    The counters live in a `struct m61_export`, normally static. After
+//    m61_setexport it is a shared file mapping that m61top can poll.
+//    Other per-shard state (the heavy-hitter summaries and the changes
+//    not yet folded into the peak totals) stays private.
 
-stats_meta* global_meta;
+#define M61_NHITTERS 32
 
-/// m61_malloc(sz, file, line)
-///    Return a pointer to `sz` bytes of newly-allocated dynamic memory.
-///    The memory is not initialized. If `sz == 0`, then m61_malloc may
-///    either return NULL or a unique, newly-allocated pointer value.
-///    The allocation request was at location `file`:`line`.
+typedef struct m61_hitter {
+    unsigned site;              // allocation site (0 if entry unused)
+    double bytes;               // estimated bytes allocated here
+    double count;               // estimated # allocations
+} m61_hitter;
 
-void* m61_malloc(size_t sz, const char* file, int line) {
+typedef struct m61_shard {
+    pthread_mutex_t hh_lock;
+    m61_hitter hh[M61_NHITTERS];
+    // see Peaks
+    long long pend_nactive __attribute__((aligned(64)));
+    long long pend_size;
+    long long pend_bucket[M61_NSIZEBUCKETS];
+} __attribute__((aligned(64))) m61_shard;
+
+static m61_shard shards[M61_NSHARDS] = {
+    [0 ... M61_NSHARDS - 1] = { .hh_lock = PTHREAD_MUTEX_INITIALIZER }
+};
+static struct m61_export local_export;
+static struct m61_export* stats_export = &local_export;
+static unsigned nshards_assigned;
+static __thread unsigned thread_shard;  // shard number + 1
+static char* heap_min;
+static char* heap_max;
+
+#define shard_add(shard, field, n) \
+    __atomic_fetch_add(&stats_export->shards[(shard)].field, (n), __ATOMIC_RELAXED)
+#define shard_sub(shard, field, n) \
+    __atomic_fetch_sub(&stats_export->shards[(shard)].field, (n), __ATOMIC_RELAXED)
+
+// Add `sz` to a fail_size counter, saturating at ULLONG_MAX: failed
+// requests are often huge, and a wrapped total would look small.
+static inline unsigned long long fail_sum(unsigned long long a, unsigned long long sz) {
+    unsigned long long x;
+    return __builtin_add_overflow(a, sz, &x) ? ULLONG_MAX : x;
+}
+
+static void shard_addfail(unsigned shard, unsigned long long sz) {
+    unsigned long long* fs = &stats_export->shards[shard].fail_size;
+    unsigned long long x = __atomic_load_n(fs, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(fs, &x, fail_sum(x, sz), 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    __atomic_fetch_add(&stats_export->shards[shard].nfail, 1, __ATOMIC_RELAXED);
+}
+
+static void shard_assign(void);
+
+static inline unsigned my_shard(void) {
+    if (!thread_shard)
+        shard_assign();
+    return thread_shard - 1;
+}
+
+static inline unsigned size_bucket(size_t sz) {
+    unsigned b = sz ? 64 - __builtin_clzll(sz) : 0;
+    return b < M61_NSIZEBUCKETS ? b : M61_NSIZEBUCKETS - 1;
+}
+
+
+// Peaks.
+//    The shards' active counters are only exact when summed, so they
+//    cannot say when the heap peaked. m61 also keeps global active
+//    totals, and active block counts per size bucket. Each shard gathers
+//    its changes to these in `pend_*` and folds them into the totals
+//    only once they reach M61_PEAKBATCH blocks (M61_PEAKBATCH_BYTES
+//    bytes), and when its thread exits, so the totals' cache line is
+//    written rarely.
+//
+//    An allocation first compares the totals plus its own shard's
+//    pending change with the peak. That estimate is exact with one
+//    thread, but other shards' unfolded changes can push it either way,
+//    so when it beats the peak, m61 adds up the totals and every
+//    assigned shard's pending change, and records that sum if it is
+//    larger. Folds are bracketed by `fold_begin` and `fold_end`, and a
+//    sum that overlapped a fold is retried, so a change is never counted
+//    both pending and folded. The sum is not a snapshot of other threads'
+//    concurrent calls, so with several threads a peak can be off by the
+//    allocations in flight while it is taken; and an estimate that falls
+//    short because of others' pending increases (up to a batch per
+//    shard) misses a peak. A new maximum, which is rare outside growth
+//    phases, is recorded with a compare-and-swap. The time of the byte
+//    peak comes from the coarse monotonic clock, which is cheap to read.
+//    Arena blocks count in the totals, but not in the size buckets,
+//    since arenas free them in bulk.
+
+#define M61_PEAKBATCH           64
+#define M61_PEAKBATCH_BYTES     (1LL << 20)
+
+typedef struct m61_peaks {
+    long long nactive;
+    long long active_size;
+    long long bucket_active[M61_NSIZEBUCKETS];
+    unsigned long long fold_begin;          // # folds started
+    unsigned long long fold_end;            // # folds finished
+    unsigned long long peak_nactive __attribute__((aligned(64)));
+    unsigned long long peak_active_size;
+    unsigned long long peak_time;           // ns on the coarse clock
+    unsigned long long bucket_peak[M61_NSIZEBUCKETS];
+} __attribute__((aligned(64))) m61_peaks;
+
+static m61_peaks peaks;
+static unsigned long long peak_start;       // coarse clock at m61_init
+static pthread_key_t peak_key;              // destructor folds at exit
+static pthread_once_t peak_key_once = PTHREAD_ONCE_INIT;
+
+static inline unsigned long long coarse_nsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Raise `*peak` to `x` if `x` is larger; return 1 if it was raised.
+static inline int peak_raise(unsigned long long* peak, unsigned long long x) {
+    unsigned long long p = __atomic_load_n(peak, __ATOMIC_RELAXED);
+    while (x > p) {
+        if (__atomic_compare_exchange_n(peak, &p, x, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            return 1;
+    }
+    return 0;
+}
+
+// Move the pending change `p` from `*pend` to `*total`.
+static inline void peak_move(long long* pend, long long* total, long long p) {
+    __atomic_fetch_add(&peaks.fold_begin, 1, __ATOMIC_ACQ_REL);
+    __atomic_fetch_sub(pend, p, __ATOMIC_RELAXED);
+    __atomic_fetch_add(total, p, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&peaks.fold_end, 1, __ATOMIC_RELEASE);
+}
+
+/// peak_fold(pend, total, delta, batch)
+///    Add `delta` to the pending change `*pend`, folding it into `*total`
+///    once it reaches `batch` either way. Return `*total` plus what
+///    remains pending: an estimate of the current value.
+
+static inline long long peak_fold(long long* pend, long long* total,
+                                  long long delta, long long batch) {
+    long long p = __atomic_add_fetch(pend, delta, __ATOMIC_RELAXED);
+    if (p >= batch || p <= -batch) {
+        peak_move(pend, total, p);
+        p = 0;
+    }
+    return __atomic_load_n(total, __ATOMIC_RELAXED) + p;
+}
+
+/// peak_sum(total, pend_offset)
+///    Return `*total` plus the pending change at byte offset
+///    `pend_offset` in every assigned shard, read while no fold runs.
+
+static long long peak_sum(const long long* total, size_t pend_offset) {
+    unsigned n = __atomic_load_n(&nshards_assigned, __ATOMIC_RELAXED);
+    n = n < M61_NSHARDS ? n : M61_NSHARDS;
+    while (1) {
+        unsigned long long b = __atomic_load_n(&peaks.fold_begin, __ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&peaks.fold_end, __ATOMIC_ACQUIRE) != b)
+            continue;               // a fold is running
+        long long x = __atomic_load_n(total, __ATOMIC_RELAXED);
+        for (unsigned i = 0; i < n; ++i)
+            x += __atomic_load_n((long long*) ((char*) &shards[i] + pend_offset),
+                                 __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&peaks.fold_begin, __ATOMIC_RELAXED) == b)
+            return x;
+    }
+}
+
+/// peak_add(count, bytes)
+///    Add `count` blocks and `bytes` bytes (either may be negative) to
+///    the active totals, and record any new peak.
+
+static inline void peak_add(long long count, long long bytes) {
+    m61_shard* s = &shards[my_shard()];
+    long long n = peak_fold(&s->pend_nactive, &peaks.nactive, count, M61_PEAKBATCH);
+    long long sz = peak_fold(&s->pend_size, &peaks.active_size, bytes,
+                             M61_PEAKBATCH_BYTES);
+    if (count > 0 && n > 0
+        && (unsigned long long) n > __atomic_load_n(&peaks.peak_nactive, __ATOMIC_RELAXED)) {
+        n = peak_sum(&peaks.nactive, offsetof(m61_shard, pend_nactive));
+        if (n > 0)
+            peak_raise(&peaks.peak_nactive, n);
+    }
+    if (bytes > 0 && sz > 0
+        && (unsigned long long) sz > __atomic_load_n(&peaks.peak_active_size, __ATOMIC_RELAXED)) {
+        sz = peak_sum(&peaks.active_size, offsetof(m61_shard, pend_size));
+        if (sz > 0 && peak_raise(&peaks.peak_active_size, sz))
+            __atomic_store_n(&peaks.peak_time, coarse_nsec(), __ATOMIC_RELAXED);
+    }
+}
+
+/// peak_bucket(sz, dir)
+///    Add (`dir` = 1) or remove (`dir` = -1) a `sz`-byte block from its
+///    size bucket's active count, and record any new peak.
+
+static inline void peak_bucket(size_t sz, int dir) {
+    unsigned b = size_bucket(sz);
+    long long n = peak_fold(&shards[my_shard()].pend_bucket[b],
+                            &peaks.bucket_active[b], dir, M61_PEAKBATCH);
+    if (dir > 0 && n > 0
+        && (unsigned long long) n > __atomic_load_n(&peaks.bucket_peak[b], __ATOMIC_RELAXED)) {
+        n = peak_sum(&peaks.bucket_active[b],
+                     offsetof(m61_shard, pend_bucket) + b * sizeof(long long));
+        if (n > 0)
+            peak_raise(&peaks.bucket_peak[b], n);
+    }
+}
+
+/// peak_thread_exit(shard)
+///    Fold all of `shard`'s pending changes into the totals. Runs when a
+///    thread that used `shard` exits, so an exited thread's changes do
+///    not skew other threads' estimates.
+
+static void peak_thread_exit(void* arg) {
+    m61_shard* s = arg;
+    long long p;
+    if ((p = __atomic_load_n(&s->pend_nactive, __ATOMIC_RELAXED)))
+        peak_move(&s->pend_nactive, &peaks.nactive, p);
+    if ((p = __atomic_load_n(&s->pend_size, __ATOMIC_RELAXED)))
+        peak_move(&s->pend_size, &peaks.active_size, p);
+    for (int b = 0; b < M61_NSIZEBUCKETS; ++b)
+        if ((p = __atomic_load_n(&s->pend_bucket[b], __ATOMIC_RELAXED)))
+            peak_move(&s->pend_bucket[b], &peaks.bucket_active[b], p);
+}
+
+static void peak_key_create(void) {
+    pthread_key_create(&peak_key, peak_thread_exit);
+}
+
+/// shard_assign()
+///    Give the calling thread a shard, and arrange for its pending peak
+///    changes to be folded when it exits.
+
+static void shard_assign(void) {
+    unsigned i = __atomic_fetch_add(&nshards_assigned, 1, __ATOMIC_RELAXED);
+    thread_shard = i % M61_NSHARDS + 1;
+    pthread_once(&peak_key_once, peak_key_create);
+    pthread_setspecific(peak_key, &shards[thread_shard - 1]);
+}
+
+
+// Latency histograms.
+//    When enabled, one in M61_LATENCYSAMPLE calls to m61_malloc and
+//    m61_free per thread is timed with the cycle counter and counted in a
+//    power-of-two histogram. Sampling keeps the added cost to a
+//    thread-local decrement on most calls.
+
+#define M61_LATENCYSAMPLE 8
+
+static int histograms_enabled;
+static __thread unsigned malloc_countdown;
+static __thread unsigned free_countdown;
+
+static inline uint64_t m61_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static inline int latency_sampled(unsigned* countdown) {
+    if (!histograms_enabled || (*countdown)-- != 0)
+        return 0;
+    *countdown = M61_LATENCYSAMPLE - 1;
+    return 1;
+}
+
+static inline unsigned cycle_bucket(uint64_t cycles) {
+    unsigned b = cycles ? 64 - __builtin_clzll(cycles) : 0;
+    return b < M61_NCYCLEBUCKETS ? b : M61_NCYCLEBUCKETS - 1;
+}
+
+/// heap_extend(first, last)
+///    Widen [heap_min, heap_max] to include [first, last].
+
+static void heap_extend(char* first, char* last) {
+    char* x = __atomic_load_n(&heap_min, __ATOMIC_RELAXED);
+    while ((!x || first < x)
+           && !__atomic_compare_exchange_n(&heap_min, &x, first, 1,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    x = __atomic_load_n(&heap_max, __ATOMIC_RELAXED);
+    while (last > x
+           && !__atomic_compare_exchange_n(&heap_max, &x, last, 1,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+
+// Allocation sites.
+//    Each distinct file:line gets a small integer id, so block headers
+//    store 4 bytes instead of a file pointer and line. Ids are assigned
+//    under `site_lock`; a per-thread direct-mapped cache makes repeat
+//    lookups lock-free. Sites are stored in fixed-size chunks that never
+//    move, so site_get needs no lock. Id 0 means "no site".
+//
+//    A site whose line is M61_PCLINE is a code address passed in place of
+//    the file name (see m61preload.c). It is only symbolized when a
+//    report first prints it. A site whose line is M61_STACKLINE is an
+//    allocation site plus its callers, and its "file" is an m61_stack
+//    (see Call stacks below).
+
+#define M61_SITECHUNK 1024
+#define M61_MAXSITECHUNKS 4096
+#define M61_STACKLINE (-2)
+#define M61_MAXSTACKDEPTH 32
+
+typedef struct m61_stack {
+    const char* file;           // innermost site
+    int line;
+    unsigned depth;             // # callers
+    size_t hash;
+    const void* frames[];       // callers' return addresses, innermost first
+} m61_stack;
+
+typedef struct m61_site {
+    const char* file;
+    int line;
+    char* name;                 // printable form, made by site_name
+} m61_site;
+
+typedef struct m61_sitecache {
+    const char* file;
+    int line;
+    unsigned site;
+} m61_sitecache;
+
+static m61_site* site_chunks[M61_MAXSITECHUNKS];
+static unsigned nsites = 1;
+static unsigned* site_slots;            // hash of file contents and line
+static size_t site_slot_capacity;
+static pthread_mutex_t site_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread m61_sitecache site_cache[256];
+
+static inline m61_site* site_get(unsigned site) {
+    return &site_chunks[site / M61_SITECHUNK][site % M61_SITECHUNK];
+}
+
+static size_t site_hash(const char* file, int line) {
+    size_t h = 14695981039346656037ULL;
+    if (line < 0)               // M61_PCLINE or M61_STACKLINE
+        h ^= (uintptr_t) file;
+    else
+        for (const char* s = file; *s; ++s)
+            h = (h ^ (unsigned char) *s) * 1099511628211ULL;
+    return (h ^ line) * 0x9E3779B97F4A7C15ULL;
+}
+
+// Find or create the site for `file`:`line`. `site_lock` must be held.
+static unsigned site_intern_locked(const char* file, int line) {
+    if (2 * nsites >= site_slot_capacity) {
+        unsigned* old_slots = site_slots;
+        size_t old_capacity = site_slot_capacity;
+        site_slot_capacity = old_capacity ? old_capacity * 2 : 1024;
+        site_slots = calloc(site_slot_capacity, sizeof(unsigned));
+        if (!site_slots)
+            abort();
+        for (size_t i = 0; i < old_capacity; ++i)
+            if (old_slots[i]) {
+                m61_site* st = site_get(old_slots[i]);
+                size_t j = site_hash(st->file, st->line);
+                while (site_slots[j & (site_slot_capacity - 1)])
+                    ++j;
+                site_slots[j & (site_slot_capacity - 1)] = old_slots[i];
+            }
+        free(old_slots);
+    }
+
+    size_t mask = site_slot_capacity - 1;
+    size_t j = site_hash(file, line);
+    for (; site_slots[j & mask]; ++j) {
+        m61_site* st = site_get(site_slots[j & mask]);
+        if (st->line == line
+            && (line < 0 ? st->file == file : strcmp(st->file, file) == 0))
+            return site_slots[j & mask];
+    }
+
+    if (nsites == M61_SITECHUNK * M61_MAXSITECHUNKS)
+        return 0;
+    unsigned site = nsites;
+    if (!site_chunks[site / M61_SITECHUNK]) {
+        site_chunks[site / M61_SITECHUNK] = calloc(M61_SITECHUNK, sizeof(m61_site));
+        if (!site_chunks[site / M61_SITECHUNK])
+            abort();
+    }
+    site_get(site)->file = file;
+    site_get(site)->line = line;
+    site_get(site)->name = NULL;
+    site_slots[j & mask] = site;
+    __atomic_store_n(&nsites, site + 1, __ATOMIC_RELEASE);
+    return site;
+}
+
+/// site_intern(file, line)
+///    Return the id of allocation site `file`:`line`.
+
+static inline unsigned site_intern(const char* file, int line) {
+    m61_sitecache* c = &site_cache[(((uintptr_t) file >> 3) ^ line) % 256];
+    if (c->file != file || c->line != line) {
+        pthread_mutex_lock(&site_lock);
+        c->site = site_intern_locked(file ? file : "?", line);
+        pthread_mutex_unlock(&site_lock);
+        c->file = file;
+        c->line = line;
+    }
+    return c->site;
+}
+
+/// site_format(buf, sz, file, line)
+///    Write the printable form of site `file`:`line` into `buf` and return
+///    `buf`. Code addresses are symbolized as OBJECT(SYMBOL+OFFSET), like
+///    backtrace_symbols. A call stack prints as its innermost site.
+
+static const char* site_format(char* buf, size_t sz, const char* file, int line) {
+    Dl_info info;
+    if (line == M61_STACKLINE) {
+        const m61_stack* stk = (const m61_stack*) file;
+        return site_format(buf, sz, stk->file, stk->line);
+    } else if (line != M61_PCLINE)
+        snprintf(buf, sz, "%s:%d", file, line);
+    else if (!dladdr(file, &info) || !info.dli_fname)
+        snprintf(buf, sz, "%p", file);
+    else if (info.dli_sname)
+        snprintf(buf, sz, "%s(%s+0x%tx)", info.dli_fname, info.dli_sname,
+                 file - (const char*) info.dli_saddr);
+    else
+        snprintf(buf, sz, "%s(+0x%tx)", info.dli_fname,
+                 file - (const char*) info.dli_fbase);
+    return buf;
+}
+
+/// site_name(site)
+///    Return the printable form of `site`, formatting it on first use.
+
+static const char* site_name(unsigned site) {
+    m61_site* st = site_get(site);
+    char* name = __atomic_load_n(&st->name, __ATOMIC_ACQUIRE);
+    if (!name) {
+        char buf[1024];
+        size_t len = strlen(site_format(buf, sizeof(buf), st->file, st->line));
+        pthread_mutex_lock(&site_lock);
+        if (!(name = st->name)) {
+            name = malloc(len + 1);
+            if (!name)
+                abort();
+            memcpy(name, buf, len + 1);
+            __atomic_store_n(&st->name, name, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&site_lock);
+    }
+    return name;
+}
+
+
+// Call stacks.
+//    With m61_setstackdepth(N), each allocation also records the return
+//    addresses of up to N callers above its site, so blocks allocated
+//    through a wrapper are told apart by who called the wrapper. Stacks
+//    are deduplicated in a hash table and each distinct stack becomes a
+//    site of its own, so a block still stores a 4-byte id, and leak and
+//    heavy-hitter reports group blocks by full stack. Stack records are
+//    never freed; a per-thread cache makes repeat lookups lock-free.
+//
+//    Capture uses backtrace(3), which reads unwind tables and so works
+//    without frame pointers, but costs around a microsecond per call.
+//    Capture is off by default.
+
+static unsigned stack_depth;
+static m61_stack** stack_slots;     // open-addressed; NULL is empty
+static size_t stack_slot_capacity;
+static size_t nstacks;
+static pthread_mutex_t stack_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread m61_stack* stack_cache[64];
+
+static inline int stack_equal(const m61_stack* stk, const char* file, int line,
+                              const void* const* frames, unsigned depth, size_t hash) {
+    return stk->hash == hash && stk->file == file && stk->line == line
+        && stk->depth == depth
+        && memcmp(stk->frames, frames, depth * sizeof(void*)) == 0;
+}
+
+// Find or create the stack record for these frames. `stack_lock` must
+// be held.
+static m61_stack* stack_intern_locked(const char* file, int line,
+                                      const void* const* frames, unsigned depth,
+                                      size_t hash) {
+    if (2 * (nstacks + 1) > stack_slot_capacity) {
+        m61_stack** old_slots = stack_slots;
+        size_t old_capacity = stack_slot_capacity;
+        stack_slot_capacity = old_capacity ? old_capacity * 2 : 1024;
+        stack_slots = calloc(stack_slot_capacity, sizeof(m61_stack*));
+        if (!stack_slots)
+            abort();
+        for (size_t i = 0; i < old_capacity; ++i)
+            if (old_slots[i]) {
+                size_t j = old_slots[i]->hash;
+                while (stack_slots[j & (stack_slot_capacity - 1)])
+                    ++j;
+                stack_slots[j & (stack_slot_capacity - 1)] = old_slots[i];
+            }
+        free(old_slots);
+    }
+
+    size_t mask = stack_slot_capacity - 1;
+    size_t j = hash;
+    for (; stack_slots[j & mask]; ++j)
+        if (stack_equal(stack_slots[j & mask], file, line, frames, depth, hash))
+            return stack_slots[j & mask];
+
+    m61_stack* stk = malloc(sizeof(m61_stack) + depth * sizeof(void*));
+    if (!stk)
+        abort();
+    stk->file = file;
+    stk->line = line;
+    stk->depth = depth;
+    stk->hash = hash;
+    memcpy(stk->frames, frames, depth * sizeof(void*));
+    stack_slots[j & mask] = stk;
+    ++nstacks;
+    return stk;
+}
+
+/// stack_capture(file, line, ra)
+///    Replace allocation site `*file`:`*line` with a call stack: the site
+///    plus its callers. `ra` is the return address of the m61 entry
+///    point; its frame is the site's, unless the site is a code address.
+
+static void __attribute__((noinline)) stack_capture(const char** file, int* line,
+                                                    const void* ra) {
+    void* buf[M61_MAXSTACKDEPTH + 16];
+    int n = backtrace(buf, M61_MAXSTACKDEPTH + 16);
+    // find the site's frame: skip m61's own frames (and libm61.so's)
+    const void* site_pc = *line == M61_PCLINE ? *file : ra;
+    int i = 0;
+    while (i < n && buf[i] != site_pc)
+        ++i;
+    if (i == n)
+        i = 2;                  // stack_capture, entry point, then site
+    int first = i + 1;
+    unsigned depth = __atomic_load_n(&stack_depth, __ATOMIC_RELAXED);
+    if (first > n)
+        first = n;
+    if ((unsigned) (n - first) < depth)
+        depth = n - first;
+    const void* const* frames = (const void* const*) &buf[first];
+
+    size_t hash = site_hash(*file, *line);
+    for (unsigned k = 0; k < depth; ++k)
+        hash = (hash ^ (uintptr_t) frames[k]) * 0x9E3779B97F4A7C15ULL;
+    m61_stack** c = &stack_cache[(hash >> 20) % 64];
+    if (!*c || !stack_equal(*c, *file, *line, frames, depth, hash)) {
+        pthread_mutex_lock(&stack_lock);
+        *c = stack_intern_locked(*file, *line, frames, depth, hash);
+        pthread_mutex_unlock(&stack_lock);
+    }
+    *file = (const char*) *c;
+    *line = M61_STACKLINE;
+}
+
+/// stack_locate(file, line, ra)
+///    If call stacks are enabled, replace `*file`:`*line` with the call
+///    stack of the current allocation. `ra` is the entry point's return
+///    address. Does nothing if the site already is a call stack, as for
+///    the m61_malloc inside m61_realloc.
+
+static inline void stack_locate(const char** file, int* line, const void* ra) {
+    if (__builtin_expect(__atomic_load_n(&stack_depth, __ATOMIC_RELAXED) != 0, 0)
+        && *line != M61_STACKLINE)
+        stack_capture(file, line, ra);
+}
+
+/// site_stack(site)
+///    Return `site`'s call stack, or NULL if it has none.
+
+static const m61_stack* site_stack(unsigned site) {
+    if (!site || site_get(site)->line != M61_STACKLINE)
+        return NULL;
+    return (const m61_stack*) site_get(site)->file;
+}
+
+/// print_stack(site)
+///    Print the callers in `site`'s call stack, if any, one per line.
+
+static void print_stack(unsigned site) {
+    const m61_stack* stk = site_stack(site);
+    char buf[1024];
+    for (unsigned i = 0; stk && i < stk->depth; ++i)
+        printf("    at %s\n", site_format(buf, sizeof(buf), stk->frames[i], M61_PCLINE));
+}
+
+/// m61_setstackdepth(depth)
+///    Record up to `depth` callers above each allocation's site, and
+///    group reports by call stack. 0 (the default) turns capture off.
+///    Blocks allocated earlier keep the sites they had.
+
+void m61_setstackdepth(unsigned depth) {
+    if (depth) {
+        // the first backtrace may load the unwinder, which allocates
+        void* buf[1];
+        backtrace(buf, 1);
+    }
+    __atomic_store_n(&stack_depth, depth < M61_MAXSTACKDEPTH ? depth : M61_MAXSTACKDEPTH,
+                     __ATOMIC_RELAXED);
+}
+
+
+// Heavy hitters.
+//    Each shard summarizes bytes allocated per file:line site with the
+//    Space-Saving algorithm: M61_NHITTERS counters, where a new site
+//    evicts the smallest counter and inherits its value. Any site with
+//    more than 1/M61_NHITTERS of a shard's bytes is guaranteed a counter,
+//    and counts overestimate by at most the evicted value. Memory is
+//    constant no matter how many sites there are.
+//
+//    With a sampling interval of S bytes, only about one allocation per
+//    S bytes is counted (tcmalloc-style byte sampling), and each sample
+//    is weighted by the inverse of its sampling probability so the
+//    estimates stay unbiased. S == 0 counts every allocation exactly.
+//    In sampling mode (m61_setsampling) only sampled blocks reach the
+//    summaries, weighted the same way, and this interval is unused.
+
+static size_t heavy_interval;
+static __thread long long heavy_countdown;
+static __thread uint64_t heavy_random;
+static size_t sample_interval;      // sampling mode's interval, 0 if off
+
+static double heavy_uniform(void) {
+    if (!heavy_random)
+        heavy_random = (uintptr_t) &heavy_random | 1;
+    heavy_random ^= heavy_random << 13;
+    heavy_random ^= heavy_random >> 7;
+    heavy_random ^= heavy_random << 17;
+    return ((heavy_random >> 11) + 0.5) / 9007199254740992.0;
+}
+
+/// sample_weight(sz)
+///    Return the inverse of the probability that sampling mode samples a
+///    block of `sz` bytes, or 1 if sampling mode is off.
+
+static inline double sample_weight(size_t sz) {
+    size_t interval = __atomic_load_n(&sample_interval, __ATOMIC_RELAXED);
+    if (!interval)
+        return 1;
+    return -1 / expm1(-(double) (sz ? sz : 1) / interval);
+}
+
+/// heavy_record(shard, site, sz)
+///    Account an allocation of `sz` bytes at `site` in `shard`'s
+///    heavy-hitter summary, subject to sampling.
+
+static void heavy_record(m61_shard* shard, unsigned site, size_t sz) {
+    double bytes = sz, count = 1;
+    size_t interval = heavy_interval;
+    if (__atomic_load_n(&sample_interval, __ATOMIC_RELAXED)) {
+        double w = sample_weight(sz);
+        bytes *= w;
+        count *= w;
+    } else if (interval) {
+        heavy_countdown -= sz;
+        if (heavy_countdown > 0)
+            return;
+        heavy_countdown = (long long) (-log(heavy_uniform()) * interval) + 1;
+        double p = -expm1(-(double) sz / interval);
+        bytes /= p;
+        count /= p;
+    }
+
+    pthread_mutex_lock(&shard->hh_lock);
+    m61_hitter* min = &shard->hh[0];
+    for (m61_hitter* h = shard->hh; h != shard->hh + M61_NHITTERS; ++h) {
+        if (h->site == site) {
+            min = h;
+            goto found;
+        } else if (!h->site || (min->site && h->bytes < min->bytes)) {
+            min = h;
+        }
+    }
+    min->site = site;
+ found:
+    min->bytes += bytes;
+    min->count += count;
+    pthread_mutex_unlock(&shard->hh_lock);
+}
+
+static int hitter_site_compare(const void* a, const void* b) {
+    const m61_hitter* ha = a, * hb = b;
+    return (ha->site > hb->site) - (ha->site < hb->site);
+}
+
+static int hitter_bytes_compare(const void* a, const void* b) {
+    const m61_hitter* ha = a, * hb = b;
+    return ha->bytes < hb->bytes ? 1 : (ha->bytes > hb->bytes ? -1 : 0);
+}
+
+/// m61_setheavysampling(interval)
+///    Count about one allocation per `interval` bytes in the heavy-hitter
+///    summaries. 0 (the default) counts every allocation.
+
+void m61_setheavysampling(size_t interval) {
+    heavy_interval = interval;
+}
+
+
+// Live counters.
+//    Each site counts its active blocks and bytes as they are allocated
+//    and freed, so m61_snapshot can read the live heap by site without
+//    walking it. The counters are kept per shard, in chunks that mirror
+//    the site table's and are allocated when a shard first touches them,
+//    so threads do not share counter cache lines; m61_snapshot adds up
+//    the shards. In sampling mode, sampled blocks count with their
+//    weight (rounded), so the counters are estimates; light blocks have
+//    no site and are not counted. Arena blocks are not counted either,
+//    since arenas free them in bulk.
+
+typedef struct m61_sitelive {
+    long long count;
+    long long bytes;
+} m61_sitelive;
+
+static m61_sitelive* site_live_chunks[M61_NSHARDS][M61_MAXSITECHUNKS];
+
+// Return `shard`'s live counters for `site`.
+static inline m61_sitelive* site_live_get(unsigned shard, unsigned site) {
+    m61_sitelive** cp = &site_live_chunks[shard][site / M61_SITECHUNK];
+    m61_sitelive* c = __atomic_load_n(cp, __ATOMIC_ACQUIRE);
+    if (__builtin_expect(!c, 0)) {
+        // the shard may be shared by several threads
+        m61_sitelive* nc = calloc(M61_SITECHUNK, sizeof(m61_sitelive));
+        if (!nc)
+            abort();
+        if (__atomic_compare_exchange_n(cp, &c, nc, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            c = nc;
+        else
+            free(nc);
+    }
+    return &c[site % M61_SITECHUNK];
+}
+
+/// site_live(site, sz, dir)
+///    Add (`dir` = 1) or remove (`dir` = -1) a `sz`-byte block from
+///    `site`'s live counters in the caller's shard.
+
+static inline void site_live(unsigned site, size_t sz, int dir) {
+    long long count = dir, bytes = dir * (long long) sz;
+    if (__builtin_expect(__atomic_load_n(&sample_interval, __ATOMIC_RELAXED) != 0, 0)) {
+        double w = sample_weight(sz);
+        count = dir * llround(w);
+        bytes = dir * llround(w * sz);
+    }
+    m61_sitelive* sl = site_live_get(my_shard(), site);
+    __atomic_fetch_add(&sl->count, count, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&sl->bytes, bytes, __ATOMIC_RELAXED);
+}
+
+
+// Live-allocation index.
+//    Every active block has an out-of-line record in `blocks`. `slots` is
+//    an open-addressed hash table mapping payload addresses to record
+//    numbers, so m61_free finds its block in O(1). The records also form
+//    a treap ordered by payload address, so a wild pointer can be mapped
+//    to the block that contains it in O(log n). Record 0 means "none".
+//
+//    The index is split into M61_NINDEX shards by address hash, each with
+//    its own lock, so threads freeing different blocks rarely contend.
+
+#define M61_NINDEX 16
+
+typedef struct m61_block {
+    stats_meta* meta;           // header of the block (NULL if record free)
+    unsigned left;              // treap children
+    unsigned right;
+} m61_block;
+
+typedef struct m61_index {
+    pthread_mutex_t lock;
+    m61_block* blocks;
+    unsigned nblocks;           // # records ever used, including record 0
+    unsigned block_capacity;
+    unsigned block_freelist;    // free records, chained through `left`
+    unsigned root;              // treap root
+    unsigned* slots;
+    size_t slot_capacity;       // always a power of two
+    int slot_shift;             // 64 - log2(slot_capacity)
+    size_t nslots_used;
+} __attribute__((aligned(64))) m61_index;
+
+static m61_index indexes[M61_NINDEX] = {
+    [0 ... M61_NINDEX - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER }
+};
+
+static inline uint64_t address_hash(const void* ptr) {
+    return ((uintptr_t) ptr >> 4) * 0x9E3779B97F4A7C15ULL;
+}
+
+static inline m61_index* index_for(const void* ptr) {
+    return &indexes[(((uintptr_t) ptr >> 4) * 0xC2B2AE3D27D4EB4FULL) >> 60];
+}
+
+static inline char* block_payload(m61_index* ix, unsigned b) {
+    return (char*) (ix->blocks[b].meta + 1);
+}
+
+// Treap priorities are derived from the address, so they cost no space.
+static inline unsigned block_priority(m61_index* ix, unsigned b) {
+    uintptr_t x = (uintptr_t) ix->blocks[b].meta;
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    return (unsigned) x;
+}
+
+static unsigned block_new(m61_index* ix, stats_meta* meta) {
+    unsigned b;
+    if (ix->block_freelist) {
+        b = ix->block_freelist;
+        ix->block_freelist = ix->blocks[b].left;
+    } else {
+        if (ix->nblocks == 0)
+            ix->nblocks = 1;
+        if (ix->nblocks >= ix->block_capacity) {
+            ix->block_capacity = ix->block_capacity ? ix->block_capacity * 2 : 1024;
+            ix->blocks = realloc(ix->blocks, ix->block_capacity * sizeof(m61_block));
+            if (!ix->blocks)
+                abort();
+        }
+        b = ix->nblocks++;
+    }
+    ix->blocks[b].meta = meta;
+    ix->blocks[b].left = ix->blocks[b].right = 0;
+    return b;
+}
+
+static void block_release(m61_index* ix, unsigned b) {
+    ix->blocks[b].meta = NULL;
+    ix->blocks[b].left = ix->block_freelist;
+    ix->block_freelist = b;
+}
+
+static void slots_insert(m61_index* ix, unsigned b);
+
+static void slots_grow(m61_index* ix) {
+    unsigned* old_slots = ix->slots;
+    size_t old_capacity = ix->slot_capacity;
+    ix->slot_capacity = old_capacity ? old_capacity * 2 : 1024;
+    ix->slot_shift = 64 - __builtin_ctzll(ix->slot_capacity);
+    ix->slots = calloc(ix->slot_capacity, sizeof(unsigned));
+    if (!ix->slots)
+        abort();
+    ix->nslots_used = 0;
+    for (size_t i = 0; i < old_capacity; ++i)
+        if (old_slots[i])
+            slots_insert(ix, old_slots[i]);
+    free(old_slots);
+}
+
+static inline size_t slot_home(m61_index* ix, const void* ptr) {
+    return address_hash(ptr) >> ix->slot_shift;
+}
+
+static void slots_insert(m61_index* ix, unsigned b) {
+    if (2 * (ix->nslots_used + 1) > ix->slot_capacity)
+        slots_grow(ix);
+    size_t mask = ix->slot_capacity - 1;
+    size_t i = slot_home(ix, block_payload(ix, b));
+    while (ix->slots[i])
+        i = (i + 1) & mask;
+    ix->slots[i] = b;
+    ++ix->nslots_used;
+}
+
+// Return the slot holding `ptr`'s record, or slot_capacity if absent.
+static size_t slots_find(m61_index* ix, const void* ptr) {
+    if (!ix->slot_capacity)
+        return 0;
+    size_t mask = ix->slot_capacity - 1;
+    size_t i = slot_home(ix, ptr);
+    while (ix->slots[i] && block_payload(ix, ix->slots[i]) != (char*) ptr)
+        i = (i + 1) & mask;
+    return ix->slots[i] ? i : ix->slot_capacity;
+}
+
+// Remove slot `i` using backward-shift deletion (no tombstones).
+static void slots_remove(m61_index* ix, size_t i) {
+    size_t mask = ix->slot_capacity - 1;
+    size_t j = i;
+    while (1) {
+        j = (j + 1) & mask;
+        if (!ix->slots[j])
+            break;
+        size_t home = slot_home(ix, block_payload(ix, ix->slots[j]));
+        // move slots[j] into the hole at i unless its home lies in (i, j]
+        if ((j > i && (home <= i || home > j))
+            || (j < i && (home <= i && home > j))) {
+            ix->slots[i] = ix->slots[j];
+            i = j;
+        }
+    }
+    ix->slots[i] = 0;
+    --ix->nslots_used;
+}
+
+static unsigned treap_insert(m61_index* ix, unsigned root, unsigned b) {
+    m61_block* bl = ix->blocks;
+    if (!root)
+        return b;
+    if (block_payload(ix, b) < block_payload(ix, root)) {
+        bl[root].left = treap_insert(ix, bl[root].left, b);
+        if (block_priority(ix, bl[root].left) > block_priority(ix, root)) {
+            unsigned l = bl[root].left;
+            bl[root].left = bl[l].right;
+            bl[l].right = root;
+            return l;
+        }
+    } else {
+        bl[root].right = treap_insert(ix, bl[root].right, b);
+        if (block_priority(ix, bl[root].right) > block_priority(ix, root)) {
+            unsigned r = bl[root].right;
+            bl[root].right = bl[r].left;
+            bl[r].left = root;
+            return r;
+        }
+    }
+    return root;
+}
+
+static unsigned treap_merge(m61_index* ix, unsigned l, unsigned r) {
+    if (!l || !r)
+        return l ? l : r;
+    if (block_priority(ix, l) > block_priority(ix, r)) {
+        ix->blocks[l].right = treap_merge(ix, ix->blocks[l].right, r);
+        return l;
+    } else {
+        ix->blocks[r].left = treap_merge(ix, l, ix->blocks[r].left);
+        return r;
+    }
+}
+
+static unsigned treap_remove(m61_index* ix, unsigned root, unsigned b) {
+    if (root == b)
+        return treap_merge(ix, ix->blocks[b].left, ix->blocks[b].right);
+    if (block_payload(ix, b) < block_payload(ix, root))
+        ix->blocks[root].left = treap_remove(ix, ix->blocks[root].left, b);
+    else
+        ix->blocks[root].right = treap_remove(ix, ix->blocks[root].right, b);
+    return root;
+}
+
+/// index_insert(ix, meta)
+///    Record the newly allocated block with header `meta` in shard `ix`,
+///    which must be locked.
+
+static void index_insert(m61_index* ix, stats_meta* meta) {
+    unsigned b = block_new(ix, meta);
+    slots_insert(ix, b);
+    ix->root = treap_insert(ix, ix->root, b);
+}
+
+/// index_find(ix, ptr)
+///    Return the record of the active block whose payload starts at `ptr`,
+///    or 0 if there is none. Shard `ix` must be locked.
+
+static unsigned index_find(m61_index* ix, const void* ptr) {
+    size_t i = slots_find(ix, ptr);
+    return i < ix->slot_capacity ? ix->slots[i] : 0;
+}
+
+/// index_remove(ix, b)
+///    Forget the active block with record `b`. Shard `ix` must be locked.
+
+static void index_remove(m61_index* ix, unsigned b) {
+    slots_remove(ix, slots_find(ix, block_payload(ix, b)));
+    ix->root = treap_remove(ix, ix->root, b);
+    block_release(ix, b);
+}
+
+/// index_containing(ptr)
+///    Return the header of the active block whose payload strictly
+///    contains `ptr` (not at its first byte), or NULL if there is none.
+///    Each shard is searched in turn.
+
+static stats_meta* index_containing(const void* ptr) {
+    stats_meta* meta = NULL;
+    char* best_payload = NULL;
+    for (int i = 0; i < M61_NINDEX; ++i) {
+        m61_index* ix = &indexes[i];
+        pthread_mutex_lock(&ix->lock);
+        unsigned b = ix->root, best = 0;
+        while (b) {
+            if (block_payload(ix, b) < (char*) ptr) {
+                best = b;
+                b = ix->blocks[b].right;
+            } else
+                b = ix->blocks[b].left;
+        }
+        if (best && block_payload(ix, best) > best_payload) {
+            best_payload = block_payload(ix, best);
+            meta = ix->blocks[best].meta;
+        }
+        pthread_mutex_unlock(&ix->lock);
+    }
+    if (meta && (char*) ptr < best_payload + meta->size)
+        return meta;
+    return NULL;
+}
+
+
+/// m61_backend_malloc(sz, zeroed), m61_backend_free(ptr, meta)
+///    Allocate and free the memory underlying m61 blocks. Blocks above
+///    the guard-page threshold, if one is set, come from the guard-page
+///    allocator; small blocks come from the size-class allocator when it
+///    is enabled; everything else goes to the base allocator. Sets
+///    `*zeroed` if the new block is known to be all zero. On free, the
+///    header `meta` (NULL if none) stays readable.
+
+static pthread_mutex_t base_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline void* m61_backend_malloc(size_t sz, int* zeroed) {
+    void* ptr = guard_malloc(sz, zeroed);
+    if (!ptr)
+        ptr = slab_malloc(sz, zeroed);
+    if (!ptr) {
+        *zeroed = 0;
+        pthread_mutex_lock(&base_lock);
+        ptr = base_malloc(sz);
+        pthread_mutex_unlock(&base_lock);
+    }
+    return ptr;
+}
+
+/// m61_backend_usable(ptr)
+///    Return the number of bytes actually usable in the backend block
+///    `ptr`, which may exceed the size requested for it.
+
+static inline size_t m61_backend_usable(void* ptr) {
+    size_t sz = slab_usable_size(ptr);
+    if (!sz)
+        sz = guard_usable_size(ptr);
+    return sz ? sz : malloc_usable_size(ptr);
+}
+
+static inline void m61_backend_free(void* ptr, stats_meta* meta) {
+    if (!slab_free(ptr) && !guard_free(ptr, meta)) {
+        pthread_mutex_lock(&base_lock);
+        base_free(ptr);
+        pthread_mutex_unlock(&base_lock);
+    }
+}
+
+
+/// m61_bug_abort()
+///    Abort after a MEMORY BUG report, making sure the report is not lost
+///    in stdout's buffer.
+
+static void __attribute__((noreturn)) m61_bug_abort(void) {
+    fflush(stdout);
+    abort();
+}
+
+
+// Tracing.
+//    m61_settrace logs every allocation call to a binary file for
+//    replay61. Each thread collects events in its own buffer of
+//    M61_TRACEBUF events, written out with one write() when it fills,
+//    when the thread exits, or when tracing stops. Threads' chunks can
+//    interleave in the file; replay61 restores the order by timestamp.
+//    Allocations are stamped after they return and frees before they
+//    start, so a block's events stay ordered even if it moves between
+//    threads. Calls made inside realloc and calloc are not logged
+//    separately.
+
+#define M61_TRACEBUF 1024
+
+typedef struct m61_tracebuf {
+    pthread_mutex_t lock;       // held while appending or flushing
+    unsigned n;
+    struct m61_tracebuf* next;  // in `trace_bufs`
+    struct m61_trace_event ev[M61_TRACEBUF];
+} m61_tracebuf;
+
+static int tracing;
+static int trace_fd = -1;
+static struct timespec trace_start;
+static m61_tracebuf* trace_bufs;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t trace_key;
+static pthread_once_t trace_key_once = PTHREAD_ONCE_INIT;
+static __thread m61_tracebuf* trace_buf;
+static __thread int trace_suppress;     // > 0 inside realloc and calloc
+
+// Write out `tb`'s events. `tb->lock` must be held. `trace_fd` is only
+// read or changed under `trace_lock`.
+static void trace_flush(m61_tracebuf* tb) {
+    if (tb->n) {
+        pthread_mutex_lock(&trace_lock);
+        if (trace_fd >= 0) {
+            ssize_t w = write(trace_fd, tb->ev, tb->n * sizeof(struct m61_trace_event));
+            (void) w;
+        }
+        pthread_mutex_unlock(&trace_lock);
+    }
+    tb->n = 0;
+}
+
+static void trace_thread_exit(void* arg) {
+    m61_tracebuf* tb = arg;
+    pthread_mutex_lock(&tb->lock);
+    trace_flush(tb);
+    pthread_mutex_unlock(&tb->lock);
+}
+
+static void trace_make_key(void) {
+    pthread_key_create(&trace_key, trace_thread_exit);
+}
+
+/// trace_record(op, ptr, arg, size, file, line)
+///    Log an event for the calling thread.
+
+static void trace_record(unsigned op, const void* ptr, uint64_t arg,
+                         uint64_t size, const char* file, int line) {
+    m61_tracebuf* tb = trace_buf;
+    if (!tb) {
+        tb = calloc(1, sizeof(m61_tracebuf));
+        if (!tb)
+            return;
+        pthread_mutex_init(&tb->lock, NULL);
+        pthread_once(&trace_key_once, trace_make_key);
+        pthread_setspecific(trace_key, tb);
+        pthread_mutex_lock(&trace_lock);
+        tb->next = trace_bufs;
+        trace_bufs = tb;
+        pthread_mutex_unlock(&trace_lock);
+        trace_buf = tb;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    pthread_mutex_lock(&tb->lock);
+    struct m61_trace_event* ev = &tb->ev[tb->n];
+    ev->time = (now.tv_sec - trace_start.tv_sec) * 1000000000ULL
+        + now.tv_nsec - trace_start.tv_nsec;
+    ev->ptr = (uintptr_t) ptr;
+    ev->arg = arg;
+    ev->size = size;
+    ev->site = site_intern(file, line);
+    ev->op = op;
+    if (++tb->n == M61_TRACEBUF)
+        trace_flush(tb);
+    pthread_mutex_unlock(&tb->lock);
+}
+
+#define trace_event(op, ptr, arg, size, file, line)                      \
+    do {                                                                \
+        if (__builtin_expect(tracing, 0) && !trace_suppress)            \
+            trace_record((op), (ptr), (arg), (size), (file), (line));   \
+    } while (0)
+
+static void trace_atexit(void) {
+    m61_settrace(NULL);
+}
+
+/// m61_settrace(filename)
+///    Start logging allocation events to `filename` (see replay61), or,
+///    if `filename` is NULL, stop logging and flush all buffered events.
+///    Returns 0 on success and -1 on failure.
+
+int m61_settrace(const char* filename) {
+    static int atexit_installed;
+    __atomic_store_n(&tracing, 0, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&trace_lock);
+    m61_tracebuf* bufs = trace_bufs;
+    pthread_mutex_unlock(&trace_lock);
+    for (m61_tracebuf* tb = bufs; tb; tb = tb->next) {
+        pthread_mutex_lock(&tb->lock);
+        trace_flush(tb);
+        pthread_mutex_unlock(&tb->lock);
+    }
+    pthread_mutex_lock(&trace_lock);
+    if (trace_fd >= 0)
+        close(trace_fd);
+    trace_fd = -1;
+    pthread_mutex_unlock(&trace_lock);
+    if (!filename)
+        return 0;
+
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    struct m61_trace_header h = {M61_TRACE_MAGIC, sizeof(struct m61_trace_event)};
+    if (fd < 0 || write(fd, &h, sizeof(h)) != sizeof(h)) {
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    pthread_mutex_lock(&trace_lock);
+    trace_fd = fd;
+    pthread_mutex_unlock(&trace_lock);
+    if (!atexit_installed) {
+        atexit(trace_atexit);
+        atexit_installed = 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &trace_start);
+    __atomic_store_n(&tracing, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+
+// Aligned blocks.
+//    Payloads are normally 16-byte aligned. For a larger alignment, m61
+//    over-allocates, places the header just before the first suitably
+//    aligned payload address, and stores the backend block's address in
+//    the pointer-sized slot before the header. Such headers are marked
+//    M61_ALIGNED_MARK instead of 0x0CAFEBABE while active.
+
+#define M61_ALIGNED_MARK 0x0CAFEBABA
+
+/// block_base(meta)
+///    Return the backend block holding the active block `meta`.
+
+static inline void* block_base(stats_meta* meta) {
+    if (meta->deadbeef == M61_ALIGNED_MARK)
+        return ((void**) meta)[-1];
+    return meta;
+}
+
+
+// Sampling mode.
+//    With a sampling interval of S bytes, about one allocated byte in S
+//    is sampled: a per-thread countdown is drawn from an exponential
+//    distribution with mean S and decremented by each allocation's size,
+//    and the allocation that takes it to zero is sampled, so a block of
+//    n bytes is sampled with probability 1 - exp(-n/S). Sampled blocks
+//    are full m61 blocks. The others are "light": a header marked
+//    M61_LIGHT_MARK with the size, and nothing else -- no site, index
+//    record, tail canary or heavy-hitter update. The global statistics
+//    stay exact, since they cost only a few per-shard additions. The
+//    leak summaries and heavy-hitter report see only sampled blocks and
+//    weight each by the inverse of its sampling probability, so their
+//    estimates are unbiased. Over-aligned blocks are always sampled.
+//
+//    Light blocks are recognized by reading the header before `ptr`,
+//    so once sampling mode has been used, freeing a wild pointer just
+//    past an unmapped page can crash instead of being reported.
+
+#define M61_LIGHT_MARK 0x0CAFEB0B
+
+static int sampling_used;
+static __thread long long sample_countdown;
+
+/// sample_skip(sz)
+///    Return 1 if sampling mode is on and an allocation of `sz` bytes
+///    should not be sampled.
+
+static inline int sample_skip(size_t sz) {
+    size_t interval = __atomic_load_n(&sample_interval, __ATOMIC_RELAXED);
+    if (!interval)
+        return 0;
+    sample_countdown -= sz;
+    if (sample_countdown > 0)
+        return 1;
+    sample_countdown = (long long) (-log(heavy_uniform()) * interval) + 1;
+    return 0;
+}
+
+/// block_is_light(ptr)
+///    Return 1 if `ptr`, which lies in the heap, is an active light block.
+
+static inline int block_is_light(void* ptr) {
+    return __atomic_load_n(&sampling_used, __ATOMIC_RELAXED)
+        && ((uintptr_t) ptr & 15) == 0
+        && guard_readable((stats_meta*) ptr - 1, sizeof(stats_meta))
+        && ((stats_meta*) ptr - 1)->deadbeef == M61_LIGHT_MARK;
+}
+
+/// m61_setsampling(interval)
+///    Give full metadata, canaries and site tracking to about one
+///    allocated byte in `interval`; other blocks take a cheap path.
+///    0 (the default) tracks every block. Estimates assume the interval
+///    does not change while sampled blocks are live.
+
+void m61_setsampling(size_t interval) {
+    if (interval)
+        __atomic_store_n(&sampling_used, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&sample_interval, interval, __ATOMIC_RELAXED);
+}
+
+
+/// do_malloc(sz, align, zeroed, file, line)
+///    Implement m61_malloc, without latency measurement, for payloads
+///    aligned to `align`, a power of two. Sets `*zeroed` if the payload
+///    is known to be all zero.
+
+static inline void* do_malloc(size_t sz, size_t align, int* zeroed,
+                              const char* file, int line) {
     (void) file, (void) line;   // avoid uninitialized variable warnings
     stats_meta* meta_ptr;
+    void* base = NULL;
     void* ret_ptr;
     void* end_ptr;  // pointer to end of region, for heap_max
+    int light = align <= 16 && sample_skip(sz);
+    size_t overhead = sizeof(stats_meta) + (light ? 0 : sizeof(m61_tail));
+    if (align > 16)
+        overhead += sizeof(void*) + align;
 
-    if (sizeof(stats_meta) + sz >= sz) {
-        meta_ptr = base_malloc(sz + sizeof(stats_meta) + sizeof(m61_tail)); // add space for metadata
-    } else {
-        meta_ptr = NULL; //gets rid of always-true warning
+    if (sz < (size_t) -1 - overhead) {
+        base = m61_backend_malloc(sz + overhead, zeroed); // add space for metadata
     }
 
-    if (meta_ptr == NULL) {
-        stats_global.nfail++;
-        stats_global.fail_size += (unsigned long long) sz;
-        return meta_ptr;
+    unsigned shard = my_shard();
+    if (base == NULL) {
+        shard_addfail(shard, sz);
+        return NULL;
+    }
+
+    meta_ptr = base;
+    if (align > 16) {
+        uintptr_t payload = (uintptr_t) base + sizeof(void*) + sizeof(stats_meta);
+        payload = (payload + align - 1) & ~(uintptr_t) (align - 1);
+        meta_ptr = (stats_meta*) payload - 1;
+        ((void**) meta_ptr)[-1] = base;
     }
 
     end_ptr = ((char*) meta_ptr) + sz + sizeof(stats_meta);
+    heap_extend((char*) base, (char*) end_ptr);
+    if (light) {
+        meta_ptr->deadbeef = M61_LIGHT_MARK;
+        meta_ptr->site = 0;
+        meta_ptr->size = sz;
+        shard_add(shard, nactive, 1);
+        shard_add(shard, active_size, (unsigned long long) sz);
+        shard_add(shard, ntotal, 1);
+        shard_add(shard, total_size, (unsigned long long) sz);
+        shard_add(shard, size_hist[size_bucket(sz)], 1);
+        peak_add(1, sz);
+        peak_bucket(sz, 1);
+        return meta_ptr + 1;
+    }
     m61_tail tail = {0xFEEDFEED};
     memmove(((char*) meta_ptr) + sz + sizeof(stats_meta),&tail, sizeof(m61_tail));
 
-    if ((meta_ptr <= (stats_meta*) stats_global.heap_min) || stats_global.heap_min == 0) {
-        stats_global.heap_min = (char*) meta_ptr;
-    }
+    unsigned site = site_intern(file, line);
+    meta_ptr->deadbeef = align > 16 ? M61_ALIGNED_MARK : 0x0CAFEBABE;
+    meta_ptr->site = site;
+    meta_ptr->size = sz;
+    ret_ptr = meta_ptr + 1;
+    m61_index* ix = index_for(ret_ptr);
+    pthread_mutex_lock(&ix->lock);
+    index_insert(ix, meta_ptr);
+    pthread_mutex_unlock(&ix->lock);
+    // simply updating stats
+
+    shard_add(shard, nactive, 1);
+    shard_add(shard, active_size, (unsigned long long) sz);
+    shard_add(shard, ntotal, 1);
+    shard_add(shard, total_size, (unsigned long long) sz);
+    shard_add(shard, size_hist[size_bucket(sz)], 1);
+    peak_add(1, sz);
+    peak_bucket(sz, 1);
+    heavy_record(&shards[shard], site, sz);
+    site_live(site, sz, 1);
+    return ret_ptr;
+}
+
+
+// Call do_malloc for m61_malloc or m61_calloc, timing it if sampled.
+static inline void* timed_malloc(size_t sz, int* zeroed, const char* file, int line) {
+    void* ptr;
+    if (latency_sampled(&malloc_countdown)) {
+        uint64_t start = m61_cycles();
+        ptr = do_malloc(sz, 16, zeroed, file, line);
+        shard_add(my_shard(), malloc_cycles[cycle_bucket(m61_cycles() - start)], 1);
+    } else
+        ptr = do_malloc(sz, 16, zeroed, file, line);
+    return ptr;
+}
+
+/// m61_malloc(sz, file, line)
+///    Return a pointer to `sz` bytes of newly-allocated dynamic memory.
+///    The memory is not initialized. If `sz == 0`, then m61_malloc may
+///    either return NULL or a unique, newly-allocated pointer value.
+///    The allocation request was at location `file`:`line`.
+
+void* m61_malloc(size_t sz, const char* file, int line) {
+    stack_locate(&file, &line, __builtin_return_address(0));
+    int zeroed;
+    void* ptr = timed_malloc(sz, &zeroed, file, line);
+    trace_event(M61_TRACE_MALLOC, ptr, 0, sz, file, line);
+    return ptr;
+}
+
+
+static int arena_contains(const void* ptr);
+
+/// m61_invalid_free(ptr, file, line)
+///    Report that `ptr`, passed to free or realloc at location
+///    `file`:`line`, is not an active block, and abort.
 
-    if (end_ptr >= (void*) stats_global.heap_max) {
-        stats_global.heap_max = (char*) end_ptr;
+static void __attribute__((noreturn)) m61_invalid_free(void* ptr, const char* file, int line) {
+    char where[1024];
+    site_format(where, sizeof(where), file, line);
+    stats_meta* c = index_containing(ptr);
+    if (c) {
+        printf("MEMORY BUG: %s: invalid free of pointer %p, not allocated\n  %s: %p: %p is %d bytes inside a %zu byte region allocated here\n",
+               where, ptr, site_name(c->site), c, ptr, (int) ((char*) ptr - (char*) (c + 1)), c->size);
+        m61_bug_abort();
     }
+    // The backends keep freed headers readable and unchanged (the
+    // guard-page allocator keeps the header's page resident when it
+    // drops a span), so a double free still finds its 0x0DEADBEEF mark,
+    // until the memory is reused. The guard-page arena has
+    // inaccessible pages inside the heap, so check before reading.
+    stats_meta* meta_ptr = ((stats_meta*) ptr) - 1;
+    if ((char*) meta_ptr >= heap_min
+        && guard_readable(meta_ptr, sizeof(stats_meta))
+        && meta_ptr->deadbeef == 0x0DEADBEEF) {
+        printf("MEMORY BUG: %s: invalid free of pointer %p, double free ya dingus\n", where, ptr);
+        m61_bug_abort();
+    }
+    if (arena_contains(ptr)) {
+        printf("MEMORY BUG: %s: invalid free of pointer %p, allocated in an arena\n", where, ptr);
+        m61_bug_abort();
+    }
+    printf("MEMORY BUG: %s: invalid free of pointer %p, not allocated\n", where, ptr);
+    m61_bug_abort();
+}
 
-    meta_ptr->cur = meta_ptr;
-    meta_ptr->prv = NULL;
-    meta_ptr->nxt = NULL;
-    meta_ptr->deadbeef = 0x0CAFEBABE;
-    meta_ptr->alloc_size = sz;
-    meta_ptr->file = file;
-    meta_ptr->line = line;
-    meta_ptr->size = sz;
-    // simply updating stats
 
-    if (global_meta) {
-        global_meta->cur->nxt = meta_ptr;
-        meta_ptr->prv = global_meta->cur;
-        global_meta = meta_ptr;
-    } else {
-        global_meta = meta_ptr;
+/// m61_check_heap(ptr, file, line)
+///    Abort with a MEMORY BUG report if `ptr`, passed to free or realloc
+///    at location `file`:`line`, lies outside the heap.
+
+static inline void m61_check_heap(void* ptr, const char* file, int line) {
+    if ((char*) ptr > __atomic_load_n(&heap_max, __ATOMIC_RELAXED)
+        || (char*) ptr < __atomic_load_n(&heap_min, __ATOMIC_RELAXED)) {
+        char where[1024];
+        printf("MEMORY BUG: %s: invalid free of pointer %p, not in heap\n",
+               site_format(where, sizeof(where), file, line), ptr);
+        m61_bug_abort();
     }
+}
 
-    stats_global.nactive++;
-    stats_global.active_size += (unsigned long long) sz;
-    stats_global.ntotal++;
-    stats_global.total_size += (unsigned long long) sz;
-    ret_ptr = meta_ptr + 1;
-    return ret_ptr;
+
+/// m61_check_canaries(meta, file, line)
+///    Abort with a MEMORY BUG report if the header `meta` or its tail
+///    canary was overwritten. The block is being freed or reallocated at
+///    location `file`:`line`.
+
+static inline void m61_check_canaries(stats_meta* meta, const char* file, int line) {
+    void* ptr = meta + 1;
+    m61_tail* tail = (m61_tail*) ((char*) ptr + meta->size);
+    if (tail->tl != 0xFEEDFEED
+        || (meta->deadbeef != 0x0CAFEBABE && meta->deadbeef != M61_ALIGNED_MARK)) {
+        char where[1024];
+        printf("MEMORY BUG %s: detected wild write during free of pointer %p\n",
+               site_format(where, sizeof(where), file, line), ptr);
+        m61_bug_abort();
+    }
 }
 
 
-/// m61_free(ptr, file, line)
-///    Free the memory space pointed to by `ptr`, which must have been
-///    returned by a previous call to m61_malloc and friends. If
-///    `ptr == NULL`, does nothing. The free was called at location
-///    `file`:`line`.
+// Quarantine.
+//    With a quarantine budget, freed blocks are not returned to the
+//    backend right away. Their payloads are filled with M61_POISON and
+//    they wait in a FIFO until the quarantined bytes exceed the budget.
+//    The oldest blocks are then checked and released; a changed byte
+//    means the program wrote to the block after freeing it, which is
+//    reported with the site of the free.
 
-void m61_free(void *ptr, const char *file, int line) {
-    (void) file, (void) line;   // avoid uninitialized variable warnings
-    unsigned long long size;
-    stats_meta* meta_ptr = ((stats_meta*) ptr) - 1;
-    stats_meta* actv_global = global_meta;
-    if (ptr == NULL) return;
-    if (ptr > (void*) stats_global.heap_max || ptr < (void*) stats_global.heap_min) {
-        printf("MEMORY BUG: %s:%d: invalid free of pointer %p, not in heap\n", file, line, ptr);
-        abort();
+#define M61_POISON 0xDF
+
+typedef struct m61_quarantined {
+    stats_meta* meta;
+    void* base;                 // backend block
+    unsigned free_site;
+} m61_quarantined;
+
+static m61_quarantined* quarantine;
+static size_t quarantine_capacity;  // power of two
+static size_t quarantine_head;      // index of oldest entry
+static size_t quarantine_count;
+static size_t quarantine_bytes;
+static size_t quarantine_limit;
+static pthread_mutex_t quarantine_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/// quarantine_check(q)
+///    Abort with a MEMORY BUG report if quarantined block `q` was
+///    written after it was freed.
+
+static void quarantine_check(m61_quarantined* q) {
+    stats_meta* meta = q->meta;
+    unsigned char* payload = (unsigned char*) (meta + 1);
+    size_t i = 0;
+    while (i < meta->size && payload[i] == M61_POISON)
+        ++i;
+    if (i == meta->size && meta->deadbeef == 0x0DEADBEEF)
+        return;
+    printf("MEMORY BUG: %s: use after free: %p is %zu bytes inside a %zu byte region freed here\n  %s: region was allocated here\n",
+           site_name(q->free_site), payload + i, i, meta->size,
+           site_name(meta->site));
+    m61_bug_abort();
+}
+
+/// quarantine_trim(limit)
+///    Check and release the oldest quarantined blocks until at most
+///    `limit` bytes remain. `quarantine_lock` must be held.
+
+static void quarantine_trim(size_t limit) {
+    while (quarantine_count && quarantine_bytes > limit) {
+        m61_quarantined* q = &quarantine[quarantine_head];
+        quarantine_check(q);
+        quarantine_bytes -= q->meta->size + sizeof(stats_meta) + sizeof(m61_tail);
+        m61_backend_free(q->base, q->meta);
+        quarantine_head = (quarantine_head + 1) & (quarantine_capacity - 1);
+        --quarantine_count;
     }
-    while ((actv_global != NULL) && (ptr != (void*) (actv_global->cur + 1))){
-        if (((void*) (actv_global->cur + 1) < ptr) && (ptr < (void*) (actv_global->cur + 1 + actv_global->size))) {
-            printf("MEMORY BUG: %s:%d: invalid free of pointer %p, not allocated\n  %s:%d: %p: %p is %d bytes inside a %zu byte region allocated here\n", 
-                   file, line , ptr, actv_global->file, actv_global->line, actv_global, ptr, (int) (ptr - ((void*) (actv_global->cur + 1))),actv_global->size);
+}
+
+/// quarantine_push(meta, base, file, line)
+///    Poison and quarantine the block `meta`, in backend block `base`,
+///    freed at `file`:`line`.
+
+static void quarantine_push(stats_meta* meta, void* base, const char* file, int line) {
+    memset(meta + 1, M61_POISON, meta->size);
+    unsigned free_site = site_intern(file, line);
+    pthread_mutex_lock(&quarantine_lock);
+    if (quarantine_count == quarantine_capacity) {
+        size_t new_capacity = quarantine_capacity ? quarantine_capacity * 2 : 1024;
+        m61_quarantined* q = malloc(new_capacity * sizeof(m61_quarantined));
+        if (!q)
             abort();
-        }
-        actv_global = actv_global->prv;
-    }
-    m61_tail* tail = (m61_tail*) ((char*) ptr + (meta_ptr->alloc_size));
-    if (meta_ptr->deadbeef == 0x0DEADBEEF) {
-        printf("MEMORY BUG: %s:%d: invalid free of pointer %p, double free ya dingus\n", file, line, ptr);
-        abort();
+        for (size_t i = 0; i < quarantine_count; ++i)
+            q[i] = quarantine[(quarantine_head + i) & (quarantine_capacity - 1)];
+        free(quarantine);
+        quarantine = q;
+        quarantine_capacity = new_capacity;
+        quarantine_head = 0;
     }
-    if (tail->tl != 0xFEEDFEED) {
-        printf("MEMORY BUG %s:%d: detected wild write during free of pointer %p",file, line, ptr);
-        abort();
+    m61_quarantined* q = &quarantine[(quarantine_head + quarantine_count) & (quarantine_capacity - 1)];
+    q->meta = meta;
+    q->base = base;
+    q->free_site = free_site;
+    ++quarantine_count;
+    quarantine_bytes += meta->size + sizeof(stats_meta) + sizeof(m61_tail);
+    quarantine_trim(quarantine_limit);
+    pthread_mutex_unlock(&quarantine_lock);
+}
+
+/// m61_setquarantine(limit)
+///    Keep up to `limit` bytes of freed blocks (headers included) in
+///    quarantine to catch writes after free. 0, the default, disables the
+///    quarantine; lowering the limit checks and releases the excess.
+
+void m61_setquarantine(size_t limit) {
+    pthread_mutex_lock(&quarantine_lock);
+    __atomic_store_n(&quarantine_limit, limit, __ATOMIC_RELAXED);
+    quarantine_trim(limit);
+    pthread_mutex_unlock(&quarantine_lock);
+}
+
+
+// Inherited blocks.
+//    A forked child gets a copy of its parent's heap, live blocks and
+//    all. So that parent and child do not both report those blocks as
+//    leaks, the child records the headers live at fork in `inherited`,
+//    and its leak reports skip them. Blocks leave the set when the child
+//    frees them. Processes that never forked pay only a test of
+//    `ninherited` per free.
+
+#define M61_INHERITED_REMOVED ((stats_meta*) 1)
+
+static stats_meta** inherited;      // open-addressed set of headers
+static size_t inherited_capacity;   // power of two
+static size_t ninherited;
+static pthread_mutex_t inherited_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Return the slot holding `meta`, or the empty slot where it would go.
+static size_t inherited_slot(const stats_meta* meta) {
+    size_t i = (address_hash(meta) >> 32) & (inherited_capacity - 1);
+    while (inherited[i] && inherited[i] != meta)
+        i = (i + 1) & (inherited_capacity - 1);
+    return i;
+}
+
+/// block_inherited(meta)
+///    Return 1 if the active block `meta` was inherited across fork.
+
+static int block_inherited(const stats_meta* meta) {
+    if (!__atomic_load_n(&ninherited, __ATOMIC_RELAXED))
+        return 0;
+    pthread_mutex_lock(&inherited_lock);
+    int found = ninherited && inherited[inherited_slot(meta)] == meta;
+    pthread_mutex_unlock(&inherited_lock);
+    return found;
+}
+
+static void inherited_forget(const stats_meta* meta) {
+    pthread_mutex_lock(&inherited_lock);
+    if (ninherited) {
+        size_t i = inherited_slot(meta);
+        if (inherited[i] == meta) {
+            inherited[i] = M61_INHERITED_REMOVED;
+            --ninherited;
+        }
     }
-    if (meta_ptr->deadbeef != 0x0CAFEBABE) {
-        printf("MEMORY BUG: %s:%d: invalid free of pointer %p, not allocated\n",file, line, ptr);
-        abort();
+    pthread_mutex_unlock(&inherited_lock);
+}
+
+
+/// do_free(ptr, file, line)
+///    Implement m61_free, without latency measurement.
+
+static inline void do_free(void *ptr, const char *file, int line) {
+    (void) file, (void) line;   // avoid uninitialized variable warnings
+    unsigned long long size;
+    if (ptr == NULL) return;
+    m61_check_heap(ptr, file, line);
+    if (block_is_light(ptr)) {
+        stats_meta* meta_ptr = (stats_meta*) ptr - 1;
+        meta_ptr->deadbeef = 0x0DEADBEEF;
+        size = meta_ptr->size;
+        unsigned shard = my_shard();
+        shard_sub(shard, active_size, (unsigned long long) size);
+        shard_sub(shard, nactive, 1);
+        shard_add(shard, free_hist[size_bucket(size)], 1);
+        peak_add(-1, -(long long) size);
+        peak_bucket(size, -1);
+        m61_backend_free(meta_ptr, meta_ptr);
+        return;
     }
-    if ((meta_ptr->prv != NULL) && (meta_ptr->prv != meta_ptr->prv->nxt) && (meta_ptr->nxt != NULL) && (meta_ptr->cur != meta_ptr->nxt->prv)) {
-    printf("MEMORY BUG: %s:%d: invalid free of pointer %p, double free ya dingus\n", file, line, ptr);
-    abort();
+    m61_index* ix = index_for(ptr);
+    pthread_mutex_lock(&ix->lock);
+    unsigned b = index_find(ix, ptr);
+    if (!b) {
+        pthread_mutex_unlock(&ix->lock);
+        m61_invalid_free(ptr, file, line);
     }
+    stats_meta* meta_ptr = ix->blocks[b].meta;
+    m61_check_canaries(meta_ptr, file, line);
+    void* base = block_base(meta_ptr);
     meta_ptr->deadbeef = 0x0DEADBEEF;
+    index_remove(ix, b);
+    pthread_mutex_unlock(&ix->lock);
+    if (__builtin_expect(__atomic_load_n(&ninherited, __ATOMIC_RELAXED) != 0, 0))
+        inherited_forget(meta_ptr);
+
+    size = meta_ptr->size;
+    site_live(meta_ptr->site, size, -1);
+    unsigned shard = my_shard();
+    shard_sub(shard, active_size, (unsigned long long) size);
+    shard_sub(shard, nactive, 1);
+    shard_add(shard, free_hist[size_bucket(size)], 1);
+    peak_add(-1, -(long long) size);
+    peak_bucket(size, -1);
+    if (__atomic_load_n(&quarantine_limit, __ATOMIC_RELAXED))
+        quarantine_push(meta_ptr, base, file, line);
+    else
+        m61_backend_free(base, meta_ptr);
+}
+
 
-    if (meta_ptr->nxt)
-        meta_ptr->nxt->prv = meta_ptr->prv;
+/// m61_free(ptr, file, line)
+///    Free the memory space pointed to by `ptr`, which must have been
+///    returned by a previous call to m61_malloc and friends. If
+///    `ptr == NULL`, does nothing. The free was called at location
+///    `file`:`line`.
 
-    if (meta_ptr->prv) {
-        meta_ptr->prv->nxt = meta_ptr->nxt;
-        if (global_meta == meta_ptr)
-            global_meta = meta_ptr->prv;
+void m61_free(void *ptr, const char *file, int line) {
+    if (ptr)
+        trace_event(M61_TRACE_FREE, ptr, 0, 0, file, line);
+    if (latency_sampled(&free_countdown)) {
+        uint64_t start = m61_cycles();
+        do_free(ptr, file, line);
+        shard_add(my_shard(), free_cycles[cycle_bucket(m61_cycles() - start)], 1);
+        return;
     }
+    do_free(ptr, file, line);
+}
+
 
-    if (!(meta_ptr->nxt) && !(meta_ptr->prv))
-        global_meta = NULL;
+/// m61_realloc_inplace(meta, sz, file, line)
+///    Try to resize the active block with header `meta` to `sz` bytes
+///    without moving it, which works when shrinking or when the backend
+///    block has enough slack. Guard-page blocks only shrink in place
+///    within their alignment slack. Returns 1 on success. The block's index
+///    shard must be locked. Statistics count this like a new allocation
+///    of `sz` bytes at `file`:`line` plus a free of the old block.
 
-    size = meta_ptr->alloc_size;
-    stats_global.active_size -= (unsigned long long) size;
-    stats_global.nactive--;
-    base_free(ptr);
+static int m61_realloc_inplace(stats_meta* meta, size_t sz, const char* file, int line) {
+    char* base = block_base(meta);
+    size_t usable = m61_backend_usable(base) - ((char*) meta - base);
+    if (sz > usable || usable - sz < sizeof(stats_meta) + sizeof(m61_tail))
+        return 0;
+    // a guard-page block must still end right before its guard page, as
+    // guard_malloc placed it, so an overflow keeps faulting at once
+    if (guard_usable_size(base)
+        && usable - sz - sizeof(stats_meta) - sizeof(m61_tail) > 15)
+        return 0;
+    m61_check_canaries(meta, file, line);
+
+    size_t old_sz = meta->size;
+    char* end_ptr = (char*) (meta + 1) + sz;
+    m61_tail tail = {0xFEEDFEED};
+    memmove(end_ptr, &tail, sizeof(m61_tail));
+    heap_extend((char*) meta, end_ptr);
+    site_live(meta->site, old_sz, -1);
+    meta->size = sz;
+    meta->site = site_intern(file, line);
+    site_live(meta->site, sz, 1);
+
+    unsigned shard = my_shard();
+    shard_add(shard, active_size, (unsigned long long) sz - old_sz);
+    peak_add(0, (long long) sz - (long long) old_sz);
+    peak_bucket(old_sz, -1);
+    peak_bucket(sz, 1);
+    shard_add(shard, ntotal, 1);
+    shard_add(shard, total_size, (unsigned long long) sz);
+    shard_add(shard, size_hist[size_bucket(sz)], 1);
+    shard_add(shard, free_hist[size_bucket(old_sz)], 1);
+    shard_add(shard, nrealloc, 1);
+    shard_add(shard, nrealloc_inplace, 1);
+    heavy_record(&shards[shard], meta->site, sz);
+    return 1;
 }
 
 
-/// m61_realloc(ptr, sz, file, line)
-///    Reallocate the dynamic memory pointed to by `ptr` to hold at least
-///    `sz` bytes, returning a pointer to the new block. If `ptr` is NULL,
-///    behaves like `m61_malloc(sz, file, line)`. If `sz` is 0, behaves
-///    like `m61_free(ptr, file, line)`. The allocation request was at
-///    location `file`:`line`.
+/// do_realloc(ptr, sz, file, line)
+///    Implement m61_realloc, without tracing.
 
-void* m61_realloc(void* ptr, size_t sz, const char* file, int line) {
+static void* do_realloc(void* ptr, size_t sz, const char* file, int line) {
     (void) file, (void) line;
     void* new_ptr = NULL;
-    stats_meta* meta_ptr = ((stats_meta*) ptr) - 1;
+    size_t old_sz = 0;
+    if (ptr)
+        m61_check_heap(ptr, file, line);
+    if (ptr && block_is_light(ptr)) {
+        old_sz = ((stats_meta*) ptr - 1)->size;
+    } else if (ptr) {
+        m61_index* ix = index_for(ptr);
+        pthread_mutex_lock(&ix->lock);
+        unsigned b = index_find(ix, ptr);
+        if (!b) {
+            pthread_mutex_unlock(&ix->lock);
+            m61_invalid_free(ptr, file, line);
+        }
+        stats_meta* meta_ptr = ix->blocks[b].meta;
+        old_sz = meta_ptr->size;
+        // in sampling mode, resized blocks are sampled again at their
+        // new size, so the estimates stay unbiased
+        if (sz != 0 && !__atomic_load_n(&sample_interval, __ATOMIC_RELAXED)
+            && m61_realloc_inplace(meta_ptr, sz, file, line)) {
+            pthread_mutex_unlock(&ix->lock);
+            return ptr;
+        }
+        pthread_mutex_unlock(&ix->lock);
+    }
     if (sz != 0) {
         new_ptr = m61_malloc(sz, file, line);
+        if (!new_ptr)
+            return NULL;        // the old block stays allocated
     }
+    if (ptr)                    // counted only once it cannot fail
+        shard_add(my_shard(), nrealloc, 1);
     if (ptr && new_ptr) {
         // Copy the data from `ptr` into `new_ptr`.
         // To do that, we must figure out the size of allocation `ptr`.
         // Your code here (to fix test012).
-        size_t old_sz = meta_ptr->alloc_size;
         if (old_sz < sz) {
             memcpy(new_ptr,ptr,old_sz);
         } else {
@@ -173,35 +1818,644 @@ void* m61_realloc(void* ptr, size_t sz, const char* file, int line) {
 }
 
 
+/// m61_realloc(ptr, sz, file, line)
+///    Reallocate the dynamic memory pointed to by `ptr` to hold at least
+///    `sz` bytes, returning a pointer to the new block. If `ptr` is NULL,
+///    behaves like `m61_malloc(sz, file, line)`. If `sz` is 0, behaves
+///    like `m61_free(ptr, file, line)`. If the new block cannot be
+///    allocated, returns NULL and leaves `ptr` allocated and unchanged.
+///    The allocation request was at location `file`:`line`.
+
+void* m61_realloc(void* ptr, size_t sz, const char* file, int line) {
+    stack_locate(&file, &line, __builtin_return_address(0));
+    ++trace_suppress;
+    void* new_ptr = do_realloc(ptr, sz, file, line);
+    --trace_suppress;
+    trace_event(M61_TRACE_REALLOC, new_ptr, (uintptr_t) ptr, sz, file, line);
+    return new_ptr;
+}
+
+
+/// m61_aligned_alloc(alignment, sz, file, line)
+///    Return a pointer to `sz` bytes of newly-allocated dynamic memory
+///    aligned to `alignment`, which must be a power of two; otherwise
+///    returns NULL with errno set to EINVAL. The block is freed with
+///    m61_free. The allocation request was at location `file`:`line`.
+
+void* m61_aligned_alloc(size_t alignment, size_t sz, const char* file, int line) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    stack_locate(&file, &line, __builtin_return_address(0));
+    int zeroed;
+    void* ptr = do_malloc(sz, alignment, &zeroed, file, line);
+    trace_event(M61_TRACE_ALIGNED, ptr, alignment, sz, file, line);
+    return ptr;
+}
+
+
+/// m61_posix_memalign(memptr, alignment, sz, file, line)
+///    Like posix_memalign: store in `*memptr` a pointer to `sz` bytes
+///    aligned to `alignment`, a power of two multiple of sizeof(void*).
+///    Returns 0 on success, EINVAL for a bad alignment, or ENOMEM.
+
+int m61_posix_memalign(void** memptr, size_t alignment, size_t sz, const char* file, int line) {
+    if (alignment == 0 || alignment % sizeof(void*) != 0
+        || (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+    stack_locate(&file, &line, __builtin_return_address(0));
+    int zeroed;
+    void* ptr = do_malloc(sz, alignment, &zeroed, file, line);
+    trace_event(M61_TRACE_ALIGNED, ptr, alignment, sz, file, line);
+    if (!ptr)
+        return ENOMEM;
+    *memptr = ptr;
+    return 0;
+}
+
+
 /// m61_calloc(nmemb, sz, file, line)
 ///    Return a pointer to newly-allocated dynamic memory big enough to
 ///    hold an array of `nmemb` elements of `sz` bytes each. The memory
 ///    is initialized to zero. If `sz == 0`, then m61_malloc may
 ///    either return NULL or a unique, newly-allocated pointer value.
 ///    The allocation request was at location `file`:`line`.
+///    Memory the backend knows to be zero, such as never-used slab slots
+///    and fresh guard-page spans, is not cleared again.
 
 void* m61_calloc(size_t nmemb, size_t sz, const char* file, int line) {
-    // Your code here (to fix test014).
+    stack_locate(&file, &line, __builtin_return_address(0));
     void* ptr = NULL;
-    if (nmemb * sz >= nmemb) {
-        ptr = m61_malloc(nmemb * sz, file, line);
-        memset(ptr, 0, nmemb * sz);
+    size_t total;
+    if (!__builtin_mul_overflow(nmemb, sz, &total)) {
+        int zeroed;
+        ptr = timed_malloc(total, &zeroed, file, line);
+        if (ptr && !zeroed)
+            memset(ptr, 0, total);
     } else {
-        stats_global.nfail++;
-        stats_global.fail_size += sz * nmemb;
+        // the request is over SIZE_MAX bytes, so fail_size saturates
+        shard_addfail(my_shard(), ULLONG_MAX);
     }
+    trace_event(M61_TRACE_CALLOC, ptr, nmemb, sz, file, line);
     return ptr;
 }
 
 
+// Arenas.
+//    An arena hands out blocks from large backend chunks by bumping a
+//    pointer. Arena blocks have ordinary headers, marked M61_ARENA_MARK,
+//    but no index records or tail canaries, and cannot be freed one at a
+//    time: m61_arena_reset frees them all by rewinding the arena to its
+//    first chunk, which takes constant time however many blocks there
+//    are. Chunks are kept for reuse until m61_arena_destroy. The leak
+//    report walks the block headers in each arena's used chunks.
+//
+//    An arena must not be used by two threads at once, or used while
+//    another thread prints the leak report.
+
+#define M61_ARENA_MARK 0x0A4E0A4E
+#define M61_ARENA_CHUNKSIZE 65536
+
+typedef struct m61_arena_chunk {
+    struct m61_arena_chunk* next;
+    char* used;                 // end of allocated blocks
+    char* end;                  // end of chunk
+} __attribute__((aligned(16))) m61_arena_chunk;
+
+struct m61_arena {
+    m61_arena_chunk* first;
+    m61_arena_chunk* cur;       // chunk being filled; later ones are unused
+    stats_struct stats;
+    m61_arena* next;            // in `arenas`
+    m61_arena* prev;
+    int inherited;              // blocks were allocated before fork
+};
+
+static m61_arena* arenas;
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline char* arena_chunk_data(m61_arena_chunk* c) {
+    return (char*) (c + 1);
+}
+
+/// arena_advance(arena, need)
+///    Make the chunk after `arena->cur` with room for `need` bytes the
+///    current chunk, allocating a new chunk if there is none. Returns
+///    the new current chunk, or NULL if out of memory.
+
+static m61_arena_chunk* arena_advance(m61_arena* arena, size_t need) {
+    m61_arena_chunk* c = arena->cur ? arena->cur->next : arena->first;
+    for (; c; c = c->next) {
+        c->used = arena_chunk_data(c);
+        if ((size_t) (c->end - c->used) >= need)
+            return arena->cur = c;
+    }
+
+    size_t sz = sizeof(m61_arena_chunk) + need;
+    if (sz < M61_ARENA_CHUNKSIZE)
+        sz = M61_ARENA_CHUNKSIZE;
+    int zeroed;
+    c = m61_backend_malloc(sz, &zeroed);
+    if (!c)
+        return NULL;
+    c->used = arena_chunk_data(c);
+    c->end = (char*) c + sz;
+    heap_extend((char*) c, c->end);
+    if (arena->cur) {
+        c->next = arena->cur->next;
+        arena->cur->next = c;
+    } else {
+        c->next = arena->first;
+        arena->first = c;
+    }
+    return arena->cur = c;
+}
+
+/// arena_contains(ptr)
+///    Return 1 if `ptr` points into a chunk of some arena.
+
+static int arena_contains(const void* ptr) {
+    int found = 0;
+    pthread_mutex_lock(&arena_lock);
+    for (m61_arena* a = arenas; a && !found; a = a->next)
+        for (m61_arena_chunk* c = a->first; c && !found; c = c->next)
+            found = (const char*) ptr >= arena_chunk_data(c)
+                && (const char*) ptr < c->end;
+    pthread_mutex_unlock(&arena_lock);
+    return found;
+}
+
+/// m61_arena_create()
+///    Return a new, empty arena, or NULL if out of memory.
+
+m61_arena* m61_arena_create(void) {
+    m61_arena* arena = calloc(1, sizeof(m61_arena));
+    if (!arena)
+        return NULL;
+    pthread_mutex_lock(&arena_lock);
+    arena->next = arenas;
+    if (arenas)
+        arenas->prev = arena;
+    arenas = arena;
+    pthread_mutex_unlock(&arena_lock);
+    return arena;
+}
+
+/// m61_arena_malloc(arena, sz, file, line)
+///    Return a pointer to `sz` bytes of uninitialized memory from `arena`.
+///    The block stays allocated until `arena` is reset or destroyed. The
+///    allocation request was at location `file`:`line`.
+
+void* m61_arena_malloc(m61_arena* arena, size_t sz, const char* file, int line) {
+    stack_locate(&file, &line, __builtin_return_address(0));
+    unsigned shard = my_shard();
+    size_t need = sizeof(stats_meta) + ((sz + 15) & ~(size_t) 15);
+    m61_arena_chunk* c = arena->cur;
+    if (sz > (size_t) -1 - sizeof(m61_arena_chunk) - sizeof(stats_meta) - 15
+        || ((!c || (size_t) (c->end - c->used) < need)
+            && !(c = arena_advance(arena, need)))) {
+        ++arena->stats.nfail;
+        arena->stats.fail_size = fail_sum(arena->stats.fail_size, sz);
+        shard_addfail(shard, sz);
+        return NULL;
+    }
+
+    stats_meta* meta = (stats_meta*) c->used;
+    c->used += need;
+    meta->deadbeef = M61_ARENA_MARK;
+    meta->site = site_intern(file, line);
+    meta->size = sz;
+
+    ++arena->stats.nactive;
+    arena->stats.active_size += sz;
+    ++arena->stats.ntotal;
+    arena->stats.total_size += sz;
+    if (arena->stats.nactive > arena->stats.peak_nactive)
+        arena->stats.peak_nactive = arena->stats.nactive;
+    if (arena->stats.active_size > arena->stats.peak_active_size) {
+        arena->stats.peak_active_size = arena->stats.active_size;
+        arena->stats.peak_time_ms = (coarse_nsec() - peak_start) / 1000000;
+    }
+    shard_add(shard, nactive, 1);
+    shard_add(shard, active_size, (unsigned long long) sz);
+    shard_add(shard, ntotal, 1);
+    shard_add(shard, total_size, (unsigned long long) sz);
+    shard_add(shard, size_hist[size_bucket(sz)], 1);
+    peak_add(1, sz);
+    heavy_record(&shards[shard], meta->site, sz);
+    return meta + 1;
+}
+
+/// m61_arena_reset(arena)
+///    Free every block allocated from `arena` at once. The arena keeps
+///    its memory for later allocations.
+
+void m61_arena_reset(m61_arena* arena) {
+    unsigned shard = my_shard();
+    shard_sub(shard, nactive, arena->stats.nactive);
+    shard_sub(shard, active_size, arena->stats.active_size);
+    peak_add(-(long long) arena->stats.nactive, -(long long) arena->stats.active_size);
+    arena->stats.nactive = 0;
+    arena->stats.active_size = 0;
+    arena->inherited = 0;
+    arena->cur = arena->first;
+    if (arena->first)
+        arena->first->used = arena_chunk_data(arena->first);
+}
+
+/// m61_arena_destroy(arena)
+///    Free every block allocated from `arena`, and `arena` itself.
+
+void m61_arena_destroy(m61_arena* arena) {
+    if (!arena)
+        return;
+    m61_arena_reset(arena);
+    pthread_mutex_lock(&arena_lock);
+    if (arena->prev)
+        arena->prev->next = arena->next;
+    else
+        arenas = arena->next;
+    if (arena->next)
+        arena->next->prev = arena->prev;
+    pthread_mutex_unlock(&arena_lock);
+    while (arena->first) {
+        m61_arena_chunk* c = arena->first;
+        arena->first = c->next;
+        m61_backend_free(c, NULL);
+    }
+    free(arena);
+}
+
+/// m61_arena_getstatistics(arena, stats)
+///    Store the memory statistics of `arena` in `*stats`. Blocks freed by
+///    m61_arena_reset count as freed; heap_min and heap_max are NULL.
+
+void m61_arena_getstatistics(m61_arena* arena, struct m61_statistics* stats) {
+    *stats = arena->stats;
+}
+
 
 /// m61_getstatistics(stats)
-///    Store the current memory statistics in `*stats`.
+///    Store the current memory statistics in `*stats`, including the
+///    peak active blocks and bytes (see Peaks).
 
 void m61_getstatistics(struct m61_statistics* stats) {
-    // Stub: set all statistics to enormous numbers
-    *stats = stats_global;
-    // Your code here.
+    memset(stats, 0, sizeof(*stats));
+    for (int i = 0; i < M61_NSHARDS; ++i) {
+        struct m61_counters* shard = &stats_export->shards[i];
+        stats->nactive += __atomic_load_n(&shard->nactive, __ATOMIC_RELAXED);
+        stats->active_size += __atomic_load_n(&shard->active_size, __ATOMIC_RELAXED);
+        stats->ntotal += __atomic_load_n(&shard->ntotal, __ATOMIC_RELAXED);
+        stats->total_size += __atomic_load_n(&shard->total_size, __ATOMIC_RELAXED);
+        stats->nfail += __atomic_load_n(&shard->nfail, __ATOMIC_RELAXED);
+        stats->fail_size = fail_sum(stats->fail_size,
+                                    __atomic_load_n(&shard->fail_size, __ATOMIC_RELAXED));
+        stats->nrealloc += __atomic_load_n(&shard->nrealloc, __ATOMIC_RELAXED);
+        stats->nrealloc_inplace += __atomic_load_n(&shard->nrealloc_inplace, __ATOMIC_RELAXED);
+    }
+    stats->heap_min = __atomic_load_n(&heap_min, __ATOMIC_RELAXED);
+    stats->heap_max = __atomic_load_n(&heap_max, __ATOMIC_RELAXED);
+    stats->peak_nactive = __atomic_load_n(&peaks.peak_nactive, __ATOMIC_RELAXED);
+    stats->peak_active_size = __atomic_load_n(&peaks.peak_active_size, __ATOMIC_RELAXED);
+    unsigned long long t = __atomic_load_n(&peaks.peak_time, __ATOMIC_RELAXED);
+    stats->peak_time_ms = t > peak_start ? (t - peak_start) / 1000000 : 0;
+}
+
+/// m61_getsizepeaks(peak)
+///    Store in `peak[b]`, for each of the M61_NSIZEBUCKETS size buckets
+///    (bucket b holds sizes in [2^(b-1), 2^b)), the most blocks of that
+///    size that were active at once. Arena blocks are not counted.
+
+void m61_getsizepeaks(unsigned long long* peak) {
+    for (int b = 0; b < M61_NSIZEBUCKETS; ++b)
+        peak[b] = __atomic_load_n(&peaks.bucket_peak[b], __ATOMIC_RELAXED);
+}
+
+
+/// m61_setexport(filename)
+///    Move the statistics counters into a shared mapping of `filename`
+///    so that m61top can watch them live. Counts made so far carry over,
+///    but updates racing with the move may be lost, so call this before
+///    starting threads (or set M61_EXPORT in the environment). Returns 0
+///    on success and -1 on failure.
+
+int m61_setexport(const char* filename) {
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+    void* p = MAP_FAILED;
+    if (ftruncate(fd, sizeof(struct m61_export)) == 0)
+        p = mmap(NULL, sizeof(struct m61_export), PROT_READ | PROT_WRITE,
+                 MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return -1;
+
+    struct m61_export* x = p;
+    memcpy(x->shards, stats_export->shards, sizeof(x->shards));
+    x->nshards = M61_NSHARDS;
+    x->pid = getpid();
+    __atomic_store_n(&x->magic, M61_EXPORT_MAGIC, __ATOMIC_RELEASE);
+    __atomic_store_n(&stats_export, x, __ATOMIC_RELEASE);
+    return 0;
+}
+
+
+// Heap scrubbing.
+//    m61_check_heap_step checks the header and tail canary of a few
+//    active blocks per call, resuming where the last call stopped, so
+//    corruption of long-lived blocks is found without waiting for them
+//    to be freed. The cursor is a position in the index shards' block
+//    records. Each call holds one shard lock at a time, for at most
+//    `budget` records, so callers see bounded pauses. Blocks allocated
+//    behind the cursor wait for the next pass; light blocks (sampling
+//    mode) and arena blocks have no tail and are not checked.
+
+static unsigned scrub_index;        // next shard to check
+static unsigned scrub_block = 1;    // next record in that shard
+static pthread_mutex_t scrub_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/// scrub_check(meta)
+///    Return 0 if the active block `meta` looks intact, 1 if its tail
+///    canary was overwritten, or 2 if its header was, in which case none
+///    of its fields can be trusted. Reads nothing outside the backend
+///    block before the header's fields have been checked.
+
+static int scrub_check(stats_meta* meta) {
+    if (meta->deadbeef != 0x0CAFEBABE && meta->deadbeef != M61_ALIGNED_MARK)
+        return 2;
+    char* base = (char*) meta;
+    if (meta->deadbeef == M61_ALIGNED_MARK) {
+        // the payload is the first suitably aligned address after base
+        uintptr_t payload = (uintptr_t) (meta + 1);
+        base = ((char**) meta)[-1];
+        uintptr_t first = (uintptr_t) base + sizeof(void*) + sizeof(stats_meta);
+        if (first > payload || payload - first >= (payload & -payload))
+            return 2;
+    }
+    size_t usable = m61_backend_usable(base) - ((char*) meta - base);
+    if (usable < sizeof(stats_meta) + sizeof(m61_tail)
+        || meta->size > usable - sizeof(stats_meta) - sizeof(m61_tail)
+        || meta->site >= __atomic_load_n(&nsites, __ATOMIC_ACQUIRE))
+        return 2;
+    m61_tail* tail = (m61_tail*) ((char*) (meta + 1) + meta->size);
+    return tail->tl != 0xFEEDFEED;
+}
+
+/// m61_check_heap_step(budget)
+///    Check up to `budget` index records (and the active blocks they
+///    hold), continuing the pass left off by the previous call. Aborts
+///    with a MEMORY BUG report if a header or tail canary was
+///    overwritten, naming the block's allocation site unless the header
+///    itself is damaged. Returns 1 if this call
+///    finished a pass over the whole heap, 0 otherwise.
+
+int m61_check_heap_step(size_t budget) {
+    int wrapped = 0;
+    pthread_mutex_lock(&scrub_lock);
+    while (budget > 0 && !wrapped) {
+        m61_index* ix = &indexes[scrub_index];
+        pthread_mutex_lock(&ix->lock);
+        for (; budget > 0 && scrub_block < ix->nblocks; --budget, ++scrub_block) {
+            stats_meta* meta = ix->blocks[scrub_block].meta;
+            if (!meta)
+                continue;
+            int bad = scrub_check(meta);
+            if (bad) {
+                pthread_mutex_unlock(&ix->lock);
+                pthread_mutex_unlock(&scrub_lock);
+                if (bad == 2)
+                    printf("MEMORY BUG: detected wild write to the header of active block %p\n",
+                           meta + 1);
+                else
+                    printf("MEMORY BUG: %s: detected wild write to active block %p with size %zu\n",
+                           site_name(meta->site), meta + 1, meta->size);
+                m61_bug_abort();
+            }
+        }
+        if (scrub_block >= ix->nblocks) {
+            scrub_block = 1;
+            scrub_index = (scrub_index + 1) % M61_NINDEX;
+            wrapped = scrub_index == 0;
+        }
+        pthread_mutex_unlock(&ix->lock);
+    }
+    pthread_mutex_unlock(&scrub_lock);
+    return wrapped;
+}
+
+
+// Fork.
+//    m61's pthread_atfork handlers take all of its locks before fork, in
+//    an order consistent with how the locks nest, and release them
+//    after, so the child copies consistent tables. In the child, the
+//    blocks live at fork become inherited; the statistics continue from
+//    a snapshot of the parent's, in private memory if the parent
+//    exports them; and tracing stops, since the parent will log the
+//    events buffered at fork.
+
+static m61_tracebuf* fork_trace_bufs;   // trace buffers locked for fork
+
+static void m61_fork_prepare(void) {
+    fflush(stdout);             // don't print buffered reports twice
+    pthread_mutex_lock(&scrub_lock);
+    pthread_mutex_lock(&quarantine_lock);
+    pthread_mutex_lock(&arena_lock);
+    for (int i = 0; i < M61_NINDEX; ++i)
+        pthread_mutex_lock(&indexes[i].lock);
+    pthread_mutex_lock(&inherited_lock);
+    pthread_mutex_lock(&trace_lock);
+    fork_trace_bufs = trace_bufs;
+    pthread_mutex_unlock(&trace_lock);
+    for (m61_tracebuf* tb = fork_trace_bufs; tb; tb = tb->next)
+        pthread_mutex_lock(&tb->lock);
+    pthread_mutex_lock(&trace_lock);
+    for (int i = 0; i < M61_NSHARDS; ++i)
+        pthread_mutex_lock(&shards[i].hh_lock);
+    pthread_mutex_lock(&stack_lock);
+    pthread_mutex_lock(&site_lock);
+    pthread_mutex_lock(&base_lock);
+    slab_forklock(1);
+    guard_forklock(1);
+}
+
+static void m61_fork_parent(void) {
+    guard_forklock(0);
+    slab_forklock(0);
+    pthread_mutex_unlock(&base_lock);
+    pthread_mutex_unlock(&site_lock);
+    pthread_mutex_unlock(&stack_lock);
+    for (int i = M61_NSHARDS - 1; i >= 0; --i)
+        pthread_mutex_unlock(&shards[i].hh_lock);
+    pthread_mutex_unlock(&trace_lock);
+    for (m61_tracebuf* tb = fork_trace_bufs; tb; tb = tb->next)
+        pthread_mutex_unlock(&tb->lock);
+    pthread_mutex_unlock(&inherited_lock);
+    for (int i = M61_NINDEX - 1; i >= 0; --i)
+        pthread_mutex_unlock(&indexes[i].lock);
+    pthread_mutex_unlock(&arena_lock);
+    pthread_mutex_unlock(&quarantine_lock);
+    pthread_mutex_unlock(&scrub_lock);
+}
+
+// Record every active index block in `inherited`. Index locks are held.
+static void fork_inherit_blocks(void) {
+    if (inherited)
+        munmap(inherited, inherited_capacity * sizeof(stats_meta*));
+    inherited = NULL;
+    inherited_capacity = 0;
+    ninherited = 0;
+    size_t n = 0;
+    for (int i = 0; i < M61_NINDEX; ++i)
+        n += indexes[i].nblocks;
+    size_t capacity = 1024;
+    while (capacity < 2 * n)
+        capacity *= 2;
+    void* p = mmap(NULL, capacity * sizeof(stats_meta*), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return;                 // the child will report them, too
+    inherited = p;
+    inherited_capacity = capacity;
+    size_t count = 0;
+    for (int i = 0; i < M61_NINDEX; ++i)
+        for (unsigned b = 1; b < indexes[i].nblocks; ++b)
+            if (indexes[i].blocks[b].meta) {
+                stats_meta* meta = indexes[i].blocks[b].meta;
+                inherited[inherited_slot(meta)] = meta;
+                ++count;
+            }
+    ninherited = count;
+}
+
+static void m61_fork_child(void) {
+    fork_inherit_blocks();
+    for (m61_arena* a = arenas; a; a = a->next)
+        a->inherited = 1;
+    // a fold interrupted by fork would stall peak_sum forever
+    peaks.fold_end = peaks.fold_begin;
+
+    if (stats_export != &local_export) {
+        memcpy(local_export.shards, stats_export->shards, sizeof(local_export.shards));
+        struct m61_export* x = stats_export;
+        stats_export = &local_export;
+        munmap(x, sizeof(struct m61_export));
+    }
+
+    tracing = 0;
+    if (trace_fd >= 0)
+        close(trace_fd);
+    trace_fd = -1;
+    m61_fork_parent();
+    // buffers created during prepare may be locked by threads that the
+    // child does not have
+    for (m61_tracebuf* tb = trace_bufs; tb; tb = tb->next) {
+        tb->n = 0;
+        pthread_mutex_init(&tb->lock, NULL);
+    }
+}
+
+
+/// m61_setleakcheck(enabled)
+///    If `enabled`, print a leak report (see m61_printleakreport) when
+///    the process exits. Forked children inherit the setting and report
+///    only their own blocks.
+
+static int leakcheck_enabled;
+
+static void leakcheck_atexit(void) {
+    if (leakcheck_enabled)
+        m61_printleakreport();
+}
+
+void m61_setleakcheck(int enabled) {
+    static int atexit_installed;
+    leakcheck_enabled = enabled;
+    if (enabled && !atexit_installed) {
+        atexit(leakcheck_atexit);
+        atexit_installed = 1;
+    }
+}
+
+
+/// m61_init()
+///    Install the fork handlers, and apply settings from the environment
+///    before main runs: M61_EXPORT=FILE calls m61_setexport(FILE),
+///    M61_TRACE=FILE calls m61_settrace(FILE), and M61_LEAKCHECK=1 calls
+///    m61_setleakcheck(1).
+
+static void __attribute__((constructor)) m61_init(void) {
+    peak_start = coarse_nsec();
+    pthread_atfork(m61_fork_prepare, m61_fork_parent, m61_fork_child);
+    const char* s = getenv("M61_EXPORT");
+    if (s && *s)
+        m61_setexport(s);
+    s = getenv("M61_TRACE");
+    if (s && *s)
+        m61_settrace(s);
+    s = getenv("M61_LEAKCHECK");
+    if (s && *s && strcmp(s, "0") != 0)
+        m61_setleakcheck(1);
+}
+
+
+/// m61_sethistograms(enabled)
+///    Enable or disable latency measurement and the histogram section of
+///    m61_printstatistics. Size histograms are always collected.
+
+void m61_sethistograms(int enabled) {
+    histograms_enabled = enabled;
+}
+
+
+/// m61_printhistograms()
+///    Print the size histograms of allocations and frees and the latency
+///    histograms of m61_malloc and m61_free. Empty buckets are skipped.
+
+static void m61_printhistograms(void) {
+    static struct m61_counters sum;
+    memset(&sum, 0, sizeof(sum));
+    for (int i = 0; i < M61_NSHARDS; ++i) {
+        struct m61_counters* shard = &stats_export->shards[i];
+        for (int b = 0; b < M61_NSIZEBUCKETS; ++b) {
+            sum.size_hist[b] += __atomic_load_n(&shard->size_hist[b], __ATOMIC_RELAXED);
+            sum.free_hist[b] += __atomic_load_n(&shard->free_hist[b], __ATOMIC_RELAXED);
+        }
+        for (int b = 0; b < M61_NCYCLEBUCKETS; ++b) {
+            sum.malloc_cycles[b] += __atomic_load_n(&shard->malloc_cycles[b], __ATOMIC_RELAXED);
+            sum.free_cycles[b] += __atomic_load_n(&shard->free_cycles[b], __ATOMIC_RELAXED);
+        }
+    }
+
+    printf("size histogram:           malloc       free\n");
+    for (int b = 0; b < M61_NSIZEBUCKETS; ++b)
+        if (sum.size_hist[b] || sum.free_hist[b]) {
+            unsigned long long lo = b ? 1ULL << (b - 1) : 0;
+            printf("  %10llu-%-10llu %10llu %10llu\n", lo, b ? 2 * lo - 1 : 0,
+                   sum.size_hist[b], sum.free_hist[b]);
+        }
+    printf("latency histogram (cycles, 1/%d sampled): malloc       free\n",
+           M61_LATENCYSAMPLE);
+    for (int b = 0; b < M61_NCYCLEBUCKETS; ++b)
+        if (sum.malloc_cycles[b] || sum.free_cycles[b]) {
+            unsigned long long lo = b ? 1ULL << (b - 1) : 0;
+            printf("  %10llu-%-10llu %10llu %10llu\n", lo, b ? 2 * lo - 1 : 0,
+                   sum.malloc_cycles[b], sum.free_cycles[b]);
+        }
+
+    struct m61_statistics stats;
+    m61_getstatistics(&stats);
+    printf("peak:         active %10llu   size %10llu   at %llu ms\n",
+           stats.peak_nactive, stats.peak_active_size, stats.peak_time_ms);
+    unsigned long long peak[M61_NSIZEBUCKETS];
+    m61_getsizepeaks(peak);
+    printf("peak active blocks by size:\n");
+    for (int b = 0; b < M61_NSIZEBUCKETS; ++b)
+        if (peak[b]) {
+            unsigned long long lo = b ? 1ULL << (b - 1) : 0;
+            printf("  %10llu-%-10llu %10llu\n", lo, b ? 2 * lo - 1 : 0, peak[b]);
+        }
 }
 
 
@@ -216,17 +2470,510 @@ void m61_printstatistics(void) {
            stats.nactive, stats.ntotal, stats.nfail);
     printf("malloc size:  active %10llu   total %10llu   fail %10llu\n",
            stats.active_size, stats.total_size, stats.fail_size);
+    if (histograms_enabled) {
+        printf("realloc count:      total %10llu   in place %10llu\n",
+               stats.nrealloc, stats.nrealloc_inplace);
+        m61_printhistograms();
+    }
+}
+
+
+/// m61_foreach_active(f, arg, own)
+///    Call `f(meta, arg)` for the header `meta` of every active block,
+///    including arena blocks, until `f` returns nonzero. If `own`, skip
+///    blocks inherited across fork. Index shards are locked while they
+///    are walked, so `f` must not allocate through m61.
+
+static void m61_foreach_active(int (*f)(stats_meta*, void*), void* arg, int own) {
+    int stop = 0;
+    for (int i = 0; i < M61_NINDEX && !stop; ++i) {
+        m61_index* ix = &indexes[i];
+        pthread_mutex_lock(&ix->lock);
+        for (unsigned b = 1; b < ix->nblocks && !stop; ++b)
+            if (ix->blocks[b].meta
+                && !(own && block_inherited(ix->blocks[b].meta)))
+                stop = f(ix->blocks[b].meta, arg);
+        pthread_mutex_unlock(&ix->lock);
+    }
+
+    pthread_mutex_lock(&arena_lock);
+    for (m61_arena* a = arenas; a && !stop; a = a->next) {
+        if (own && a->inherited)
+            continue;
+        for (m61_arena_chunk* c = a->first; c && !stop;
+             c = c == a->cur ? NULL : c->next)
+            for (char* p = arena_chunk_data(c); p < c->used && !stop; ) {
+                stats_meta* meta = (stats_meta*) p;
+                stop = f(meta, arg);
+                p += sizeof(stats_meta) + ((meta->size + 15) & ~(size_t) 15);
+            }
+    }
+    pthread_mutex_unlock(&arena_lock);
 }
 
 
 /// m61_printleakreport()
 ///    Print a report of all currently-active allocated blocks of dynamic
-///    memory.
+///    memory, each followed by its callers if call stacks are enabled. A
+///    forked child does not report blocks it inherited.
+
+static int print_leak(stats_meta* meta, void* arg) {
+    (void) arg;
+    printf("LEAK CHECK: %s: allocated object %p with size %zu\n", site_name(meta->site), meta + 1, meta->size);
+    print_stack(meta->site);
+    return 0;
+}
 
 void m61_printleakreport(void) {
-    stats_meta* actv_global = global_meta;
-    while (actv_global != NULL) {
-        printf("LEAK CHECK: %s:%d: allocated object %p with size %zu\n", actv_global->file, actv_global->line, actv_global + 1, actv_global->size);
-        actv_global = actv_global->prv;
-    };
+    m61_foreach_active(print_leak, NULL, 1);
+}
+
+
+// Leak summaries.
+//    Active blocks are grouped by site, or by call stack, in one pass. Site ids are dense,
+//    so the table is indexed directly by id, sized to the number of
+//    sites when the pass starts; blocks from sites created during the
+//    pass are counted under site 0.
+
+typedef struct m61_leaksite {
+    unsigned site;
+    double count;               // estimates in sampling mode
+    double bytes;
+} m61_leaksite;
+
+typedef struct m61_leaksummary {
+    m61_leaksite* sites;        // indexed by site id
+    unsigned nsites;
+} m61_leaksummary;
+
+static int summarize_leak(stats_meta* meta, void* arg) {
+    m61_leaksummary* sum = arg;
+    m61_leaksite* ls = &sum->sites[meta->site < sum->nsites ? meta->site : 0];
+    double w = sample_weight(meta->size);
+    ls->count += w;
+    ls->bytes += meta->size * w;
+    return 0;
+}
+
+static int leaksite_bytes_compare(const void* a, const void* b) {
+    const m61_leaksite* la = a;
+    const m61_leaksite* lb = b;
+    if (la->bytes != lb->bytes)
+        return la->bytes > lb->bytes ? -1 : 1;
+    return la->site < lb->site ? -1 : la->site > lb->site;
+}
+
+/// leak_summarize(sum, total)
+///    Fill `sum` with the sites that have active blocks, sorted by bytes,
+///    and `total` with the totals. Returns the number of such sites; the
+///    caller frees `sum->sites`.
+
+static unsigned leak_summarize(m61_leaksummary* sum, m61_leaksite* total) {
+    sum->nsites = __atomic_load_n(&nsites, __ATOMIC_ACQUIRE);
+    sum->sites = calloc(sum->nsites, sizeof(m61_leaksite));
+    if (!sum->sites)
+        abort();
+    m61_foreach_active(summarize_leak, sum, 1);
+
+    unsigned n = 0;
+    memset(total, 0, sizeof(*total));
+    for (unsigned i = 0; i < sum->nsites; ++i)
+        if (sum->sites[i].count) {
+            sum->sites[n] = sum->sites[i];
+            sum->sites[n].site = i;
+            total->count += sum->sites[n].count;
+            total->bytes += sum->sites[n].bytes;
+            ++n;
+        }
+    qsort(sum->sites, n, sizeof(m61_leaksite), leaksite_bytes_compare);
+    return n;
+}
+
+/// m61_printleaksummary()
+///    Print the active blocks grouped by allocation site, with the
+///    number of blocks and bytes for each, largest first.
+
+void m61_printleaksummary(void) {
+    m61_leaksummary sum;
+    m61_leaksite total;
+    unsigned n = leak_summarize(&sum, &total);
+    for (unsigned i = 0; i < n; ++i) {
+        printf("LEAK SUMMARY: %s: %.0f bytes in %.0f objects\n",
+               sum.sites[i].site ? site_name(sum.sites[i].site) : "?",
+               sum.sites[i].bytes, sum.sites[i].count);
+        print_stack(sum.sites[i].site);
+    }
+    printf("LEAK SUMMARY: total %.0f bytes in %.0f objects from %u sites\n",
+           total.bytes, total.count, n);
+    free(sum.sites);
+}
+
+// Print `str` as a JSON string.
+static void print_json_string(const char* str) {
+    putchar('"');
+    for (const unsigned char* s = (const unsigned char*) str; *s; ++s)
+        if (*s == '"' || *s == '\\')
+            printf("\\%c", *s);
+        else if (*s < 0x20)
+            printf("\\u%04x", *s);
+        else
+            putchar(*s);
+    putchar('"');
+}
+
+/// m61_printleakjson()
+///    Print the leak summary as one JSON object:
+///    {"bytes": B, "count": C, "sites": [{"site": "FILE:LINE",
+///    "bytes": B, "count": C}, ...]}, with sites largest first. Sites
+///    with call stacks also have "stack": ["CALLER", ...].
+
+void m61_printleakjson(void) {
+    m61_leaksummary sum;
+    m61_leaksite total;
+    unsigned n = leak_summarize(&sum, &total);
+    printf("{\"bytes\": %.0f, \"count\": %.0f, \"sites\": [",
+           total.bytes, total.count);
+    for (unsigned i = 0; i < n; ++i) {
+        printf(i ? ",\n  {\"site\": " : "\n  {\"site\": ");
+        print_json_string(sum.sites[i].site ? site_name(sum.sites[i].site) : "?");
+        printf(", \"bytes\": %.0f, \"count\": %.0f",
+               sum.sites[i].bytes, sum.sites[i].count);
+        const m61_stack* stk = site_stack(sum.sites[i].site);
+        if (stk) {
+            char buf[1024];
+            printf(", \"stack\": [");
+            for (unsigned k = 0; k < stk->depth; ++k) {
+                printf(k ? ", " : "");
+                print_json_string(site_format(buf, sizeof(buf), stk->frames[k], M61_PCLINE));
+            }
+            printf("]");
+        }
+        printf("}");
+    }
+    printf("]}\n");
+    free(sum.sites);
+}
+
+
+// Fragmentation.
+//    m61_getfragmentation copies the extents of up to `max_blocks` active
+//    blocks (header and tail included, plus the alignment slack of
+//    over-aligned blocks), sorts them by address and walks them once.
+//    Extents more than M61_FRAG_REGIONGAP apart are in different regions
+//    (the slab arena, the guard arena, the C library's heap, its mmapped
+//    chunks); within a region, the gaps between extents are holes, which
+//    is where the backend's free memory lies. Pages are counted only
+//    within regions.
+
+#define M61_FRAG_REGIONGAP      ((uintptr_t) 16 << 20)
+#define M61_FRAG_PAGESIZE       4096
+#define M61_FRAG_DEFAULTLIMIT   (1 << 20)
+
+typedef struct m61_extent {
+    uintptr_t first;
+    uintptr_t last;             // one past the end
+    size_t size;                // payload size
+} m61_extent;
+
+typedef struct m61_extents {
+    m61_extent* x;
+    size_t n;
+    size_t capacity;
+    int truncated;
+} m61_extents;
+
+static int collect_extent(stats_meta* meta, void* arg) {
+    m61_extents* ex = arg;
+    if (ex->n == ex->capacity) {
+        ex->truncated = 1;
+        return 1;
+    }
+    m61_extent* x = &ex->x[ex->n++];
+    x->first = (uintptr_t) block_base(meta);
+    x->last = (uintptr_t) (meta + 1) + meta->size;
+    if (meta->deadbeef != M61_ARENA_MARK)
+        x->last += sizeof(m61_tail);
+    x->size = meta->size;
+    return 0;
+}
+
+static int extent_compare(const void* a, const void* b) {
+    const m61_extent* xa = a;
+    const m61_extent* xb = b;
+    return xa->first < xb->first ? -1 : xa->first > xb->first;
+}
+
+// Add the page holding `used` bytes of live data to `frag`.
+static void frag_page(struct m61_fragmentation* frag, uintptr_t used) {
+    if (used) {
+        ++frag->npages_used;
+        ++frag->occupancy_hist[(used * M61_NOCCUPANCYBUCKETS - 1) / M61_FRAG_PAGESIZE];
+    }
+}
+
+/// m61_getfragmentation(frag, max_blocks)
+///    Fill `frag` with the fragmentation of the active heap, examining at
+///    most `max_blocks` blocks.
+
+void m61_getfragmentation(struct m61_fragmentation* frag, size_t max_blocks) {
+    memset(frag, 0, sizeof(*frag));
+    struct m61_statistics stats;
+    m61_getstatistics(&stats);
+    frag->heap_span = stats.heap_max - stats.heap_min;
+
+    m61_extents ex = {NULL, 0, 0, 0};
+    ex.capacity = stats.nactive + 1024;
+    if (ex.capacity > max_blocks)
+        ex.capacity = max_blocks;
+    ex.x = malloc(ex.capacity * sizeof(m61_extent));
+    if (!ex.x)
+        ex.capacity = 0;
+    m61_foreach_active(collect_extent, &ex, 0);
+    qsort(ex.x, ex.n, sizeof(m61_extent), extent_compare);
+    frag->nblocks = ex.n;
+    frag->truncated = ex.truncated;
+
+    uintptr_t region_first = 0, end = 0;
+    uintptr_t page = 0, page_used = 0;      // current page, live bytes on it
+    for (size_t i = 0; i < ex.n; ++i) {
+        m61_extent* x = &ex.x[i];
+        frag->live_bytes += x->size;
+        frag->footprint_bytes += x->last - x->first;
+        if (i == 0 || x->first >= end + M61_FRAG_REGIONGAP) {
+            if (i != 0)
+                frag->region_bytes += end - region_first;
+            ++frag->nregions;
+            region_first = x->first;
+            frag->npages += (x->last - 1) / M61_FRAG_PAGESIZE
+                - x->first / M61_FRAG_PAGESIZE + 1;
+        } else {
+            if (x->first > end) {
+                ++frag->nholes;
+                frag->hole_bytes += x->first - end;
+                ++frag->hole_hist[size_bucket(x->first - end)];
+            }
+            if (x->last > end)
+                frag->npages += (x->last - 1) / M61_FRAG_PAGESIZE
+                    - (end - 1) / M61_FRAG_PAGESIZE;
+        }
+        if (x->last > end)
+            end = x->last;
+
+        // page occupancy
+        uintptr_t first_page = x->first / M61_FRAG_PAGESIZE;
+        uintptr_t last_page = (x->last - 1) / M61_FRAG_PAGESIZE;
+        if (i == 0 || first_page != page) {
+            if (i != 0)
+                frag_page(frag, page_used);
+            page = first_page;
+            page_used = 0;
+        }
+        if (first_page == last_page)
+            page_used += x->last - x->first;
+        else {
+            page_used += (first_page + 1) * M61_FRAG_PAGESIZE - x->first;
+            frag_page(frag, page_used);
+            // pages wholly inside the block are full
+            frag->npages_used += last_page - first_page - 1;
+            frag->occupancy_hist[M61_NOCCUPANCYBUCKETS - 1] += last_page - first_page - 1;
+            page = last_page;
+            page_used = x->last - last_page * M61_FRAG_PAGESIZE;
+        }
+    }
+    if (ex.n) {
+        frag->region_bytes += end - region_first;
+        frag_page(frag, page_used);
+    }
+    free(ex.x);
+}
+
+/// m61_printfragmentation()
+///    Print the fragmentation of the active heap.
+
+void m61_printfragmentation(void) {
+    struct m61_fragmentation frag;
+    m61_getfragmentation(&frag, M61_FRAG_DEFAULTLIMIT);
+    printf("FRAGMENTATION: %llu blocks%s, %llu bytes live, %llu bytes with metadata\n",
+           frag.nblocks, frag.truncated ? " (walk truncated)" : "",
+           frag.live_bytes, frag.footprint_bytes);
+    printf("FRAGMENTATION: heap span %llu bytes; %llu regions spanning %llu bytes, %.1f%% live\n",
+           frag.heap_span, frag.nregions, frag.region_bytes,
+           frag.region_bytes ? 100.0 * frag.live_bytes / frag.region_bytes : 0.0);
+    printf("FRAGMENTATION: %llu holes, %llu bytes\n", frag.nholes, frag.hole_bytes);
+    for (int b = 0; b < M61_NSIZEBUCKETS; ++b)
+        if (frag.hole_hist[b]) {
+            unsigned long long lo = b ? 1ULL << (b - 1) : 0;
+            printf("FRAGMENTATION:   holes of %llu-%llu bytes: %llu\n",
+                   lo, b ? (lo << 1) - 1 : 0, frag.hole_hist[b]);
+        }
+    printf("FRAGMENTATION: %llu pages, %llu with live data\n",
+           frag.npages, frag.npages_used);
+    for (int b = 0; b < M61_NOCCUPANCYBUCKETS; ++b)
+        if (frag.occupancy_hist[b])
+            printf("FRAGMENTATION:   pages %d-%d%% live: %llu\n",
+                   b * 100 / M61_NOCCUPANCYBUCKETS,
+                   (b + 1) * 100 / M61_NOCCUPANCYBUCKETS, frag.occupancy_hist[b]);
+}
+
+
+// Snapshots.
+//    A snapshot adds up every shard's live counters for each site, in
+//    site order: O(sites) time and space, independent of the number of
+//    blocks, and it takes no index locks. Comparing two snapshots is
+//    then a merge.
+
+typedef struct m61_snapsite {
+    unsigned site;
+    long long count;
+    long long bytes;
+} m61_snapsite;
+
+struct m61_snapshot {
+    unsigned nsites;
+    m61_snapsite sites[];
+};
+
+/// m61_snapshot()
+///    Return a snapshot of the active blocks and bytes allocated at each
+///    site (see Live counters). Free it with m61_snapshot_free. Returns
+///    NULL if out of memory.
+
+struct m61_snapshot* m61_snapshot(void) {
+    unsigned n = __atomic_load_n(&nsites, __ATOMIC_ACQUIRE);
+    struct m61_snapshot* snap = malloc(sizeof(struct m61_snapshot)
+                                       + n * sizeof(m61_snapsite));
+    if (!snap)
+        return NULL;
+    snap->nsites = 0;
+    for (unsigned site = 0; site < n; ++site) {
+        long long count = 0, bytes = 0;
+        for (int i = 0; i < M61_NSHARDS; ++i) {
+            m61_sitelive* c = __atomic_load_n(&site_live_chunks[i][site / M61_SITECHUNK],
+                                              __ATOMIC_ACQUIRE);
+            if (c) {
+                count += __atomic_load_n(&c[site % M61_SITECHUNK].count, __ATOMIC_RELAXED);
+                bytes += __atomic_load_n(&c[site % M61_SITECHUNK].bytes, __ATOMIC_RELAXED);
+            }
+        }
+        if (count || bytes) {
+            m61_snapsite* ss = &snap->sites[snap->nsites];
+            ss->site = site;
+            ss->count = count;
+            ss->bytes = bytes;
+            ++snap->nsites;
+        }
+    }
+    return snap;
+}
+
+/// m61_snapshot_free(snap)
+///    Free snapshot `snap`.
+
+void m61_snapshot_free(struct m61_snapshot* snap) {
+    free(snap);
+}
+
+typedef struct m61_snapgrowth {
+    m61_snapsite change;
+    const m61_snapsite* now;
+} m61_snapgrowth;
+
+static int snapgrowth_compare(const void* a, const void* b) {
+    const m61_snapsite* sa = &((const m61_snapgrowth*) a)->change;
+    const m61_snapsite* sb = &((const m61_snapgrowth*) b)->change;
+    if (sa->bytes != sb->bytes)
+        return sa->bytes > sb->bytes ? -1 : 1;
+    return sa->site < sb->site ? -1 : sa->site > sb->site;
+}
+
+/// m61_snapshot_diff(a, b)
+///    Print the sites whose live bytes grew from snapshot `a` to later
+///    snapshot `b`, most growth first, with their growth and current
+///    totals, then the total change over all sites. A NULL `a` is an
+///    empty heap.
+
+void m61_snapshot_diff(const struct m61_snapshot* a, const struct m61_snapshot* b) {
+    unsigned na = a ? a->nsites : 0;
+    m61_snapgrowth* grown = malloc((b->nsites ? b->nsites : 1) * sizeof(m61_snapgrowth));
+    if (!grown)
+        abort();
+    unsigned ngrown = 0, i = 0;
+    long long count = 0, bytes = 0;
+    for (unsigned j = 0; j < b->nsites; ++j) {
+        const m61_snapsite* sb = &b->sites[j];
+        for (; i < na && a->sites[i].site < sb->site; ++i) {
+            count -= a->sites[i].count;
+            bytes -= a->sites[i].bytes;
+        }
+        m61_snapsite d = *sb;
+        if (i < na && a->sites[i].site == sb->site) {
+            d.count -= a->sites[i].count;
+            d.bytes -= a->sites[i].bytes;
+            ++i;
+        }
+        count += d.count;
+        bytes += d.bytes;
+        if (d.bytes > 0) {
+            grown[ngrown].change = d;
+            grown[ngrown].now = sb;
+            ++ngrown;
+        }
+    }
+    for (; i < na; ++i) {
+        count -= a->sites[i].count;
+        bytes -= a->sites[i].bytes;
+    }
+
+    qsort(grown, ngrown, sizeof(m61_snapgrowth), snapgrowth_compare);
+    for (unsigned k = 0; k < ngrown; ++k) {
+        const m61_snapsite* d = &grown[k].change;
+        printf("SNAPSHOT DIFF: %s: %+lld bytes in %+lld objects (now %lld bytes in %lld objects)\n",
+               d->site ? site_name(d->site) : "?", d->bytes, d->count,
+               grown[k].now->bytes, grown[k].now->count);
+        print_stack(d->site);
+    }
+    printf("SNAPSHOT DIFF: total %+lld bytes in %+lld objects, %u sites grew\n",
+           bytes, count, ngrown);
+    free(grown);
+}
+
+
+/// m61_printheavyreport()
+///    Print a report of heavily-used allocation sites (or call stacks):
+///    those responsible for at least 10% of allocated bytes.
+
+void m61_printheavyreport(void) {
+    static m61_hitter hitters[M61_NSHARDS * M61_NHITTERS];
+    size_t n = 0;
+    double total = 0;
+    for (int i = 0; i < M61_NSHARDS; ++i) {
+        m61_shard* shard = &shards[i];
+        pthread_mutex_lock(&shard->hh_lock);
+        for (int j = 0; j < M61_NHITTERS; ++j)
+            if (shard->hh[j].site)
+                hitters[n++] = shard->hh[j];
+        pthread_mutex_unlock(&shard->hh_lock);
+    }
+
+    // merge the shards' counters for each site
+    qsort(hitters, n, sizeof(m61_hitter), hitter_site_compare);
+    size_t nhitters = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (nhitters && hitter_site_compare(&hitters[nhitters - 1], &hitters[i]) == 0) {
+            hitters[nhitters - 1].bytes += hitters[i].bytes;
+            hitters[nhitters - 1].count += hitters[i].count;
+        } else
+            hitters[nhitters++] = hitters[i];
+        total += hitters[i].bytes;
+    }
+
+    qsort(hitters, nhitters, sizeof(m61_hitter), hitter_bytes_compare);
+    for (size_t i = 0; i < nhitters && hitters[i].bytes >= total / 10; ++i) {
+        printf("HEAVY HITTER: %s: %llu bytes (~%.1f%%) in %llu allocations\n",
+               site_name(hitters[i].site),
+               (unsigned long long) (hitters[i].bytes + 0.5),
+               100 * hitters[i].bytes / total,
+               (unsigned long long) (hitters[i].count + 0.5));
+        print_stack(hitters[i].site);
+    }
 }
@@ -1,5 +1,15 @@
 #ifndef M61_H
 #define M61_H 1
+#if M61_PRELOAD && M61_DISABLE && !M61_INTERPOSE
+// In libm61.so, malloc and friends are m61's own entry points (see
+// m61preload.c), so m61's internal allocations go straight to the C
+// library.
+# define malloc __libc_malloc
+# define free __libc_free
+# define realloc __libc_realloc
+# define calloc __libc_calloc
+# define malloc_usable_size m61_libc_usable_size
+#endif
 #include <stdlib.h>
 #include <inttypes.h>
 
@@ -7,6 +17,12 @@ void* m61_malloc(size_t sz, const char* file, int line);
 void m61_free(void* ptr, const char* file, int line);
 void* m61_realloc(void* ptr, size_t sz, const char* file, int line);
 void* m61_calloc(size_t nmemb, size_t sz, const char* file, int line);
+void* m61_aligned_alloc(size_t alignment, size_t sz, const char* file, int line);
+int m61_posix_memalign(void** memptr, size_t alignment, size_t sz, const char* file, int line);
+
+// Callers that know a code address rather than a file and line (like
+// libm61.so) pass the address as `file` and M61_PCLINE as `line`.
+#define M61_PCLINE (-1)
 
 struct m61_statistics {
     unsigned long long nactive;         // # active allocations
@@ -15,34 +31,162 @@ struct m61_statistics {
     unsigned long long total_size;      // # bytes in total allocations
     unsigned long long nfail;           // # failed allocation attempts
     unsigned long long fail_size;       // # bytes in failed alloc attempts
+                                        // (saturates at ULLONG_MAX)
     char* heap_min;                     // smallest allocated addr
     char* heap_max;                     // largest allocated addr
+    unsigned long long nrealloc;        // # reallocs of existing blocks
+    unsigned long long nrealloc_inplace; // # of those done without copying
+    unsigned long long peak_nactive;    // most active allocations at once
+    unsigned long long peak_active_size; // most bytes active at once
+    unsigned long long peak_time_ms;    // when, in ms after m61 started
 };
 
+// Header stored immediately before each payload. It is 16 bytes, so
+// payloads keep malloc's alignment; the allocation site is an id into
+// m61's site table.
 struct m61_statistics_metadata {
-    unsigned long long alloc_size;
-    unsigned int deadbeef;
-    size_t size;
-    const char *file;
-    int line;
-    struct m61_statistics_metadata* cur;
-    struct m61_statistics_metadata* prv;
-    struct m61_statistics_metadata* nxt;
+    unsigned int deadbeef;      // 0x0CAFEBABE if active (0x0CAFEBABA if
+                                // over-aligned), 0x0DEADBEEF if freed
+    unsigned int site;          // allocation site id
+    size_t size;                // payload size
+};
+
+// Live statistics. m61 keeps its counters in M61_NSHARDS per-thread
+// shards. m61_setexport places them in a shared file that m61top can
+// read, without locks, while the program runs; readers sum the shards.
+#define M61_NSHARDS 64
+#define M61_NSIZEBUCKETS 40         // bucket b: sizes in [2^(b-1), 2^b)
+#define M61_NCYCLEBUCKETS 32        // bucket b: [2^(b-1), 2^b) cycles
+#define M61_EXPORT_MAGIC 0x6D363174U
+
+struct m61_counters {
+    unsigned long long nactive;
+    unsigned long long active_size;
+    unsigned long long ntotal;
+    unsigned long long total_size;
+    unsigned long long nfail;
+    unsigned long long fail_size;
+    unsigned long long nrealloc;
+    unsigned long long nrealloc_inplace;
+    unsigned long long size_hist[M61_NSIZEBUCKETS]; // # allocations by size
+    unsigned long long free_hist[M61_NSIZEBUCKETS]; // # frees by size
+    unsigned long long malloc_cycles[M61_NCYCLEBUCKETS]; // sampled latency
+    unsigned long long free_cycles[M61_NCYCLEBUCKETS];
+} __attribute__((aligned(64)));
+
+struct m61_export {
+    unsigned magic;                 // M61_EXPORT_MAGIC once initialized
+    unsigned nshards;
+    long pid;
+    struct m61_counters shards[M61_NSHARDS];
+};
+
+// Allocation traces, written by m61_settrace and read by replay61: a
+// struct m61_trace_header followed by events.
+#define M61_TRACE_MAGIC 0x6D363172U
+#define M61_TRACE_MALLOC    1
+#define M61_TRACE_FREE      2
+#define M61_TRACE_REALLOC   3       // arg: old address
+#define M61_TRACE_CALLOC    4       // arg: element count; size: element size
+#define M61_TRACE_ALIGNED   5       // arg: alignment
+
+struct m61_trace_header {
+    unsigned magic;                 // M61_TRACE_MAGIC
+    unsigned event_size;            // sizeof(struct m61_trace_event)
+};
+
+struct m61_trace_event {
+    uint64_t time;                  // nanoseconds since tracing started
+    uint64_t ptr;                   // block address (result, or freed block)
+    uint64_t arg;
+    uint64_t size;                  // requested size
+    uint32_t site;                  // allocation site id
+    uint32_t op;                    // M61_TRACE_*
+};
+
+// Fragmentation of the active heap, from m61_getfragmentation. Blocks
+// count with their metadata; a region is a run of blocks with no gap of
+// 16 MiB or more, and holes are the gaps inside regions.
+#define M61_NOCCUPANCYBUCKETS 10    // bucket b: pages (b*10%, (b+1)*10%] live
+
+struct m61_fragmentation {
+    unsigned long long nblocks;         // # active blocks examined
+    int truncated;                      // 1 if more blocks were active
+    unsigned long long live_bytes;      // payload bytes in those blocks
+    unsigned long long footprint_bytes; // bytes they occupy, with metadata
+    unsigned long long heap_span;       // heap_max - heap_min
+    unsigned long long nregions;
+    unsigned long long region_bytes;    // bytes spanned by regions
+    unsigned long long nholes;
+    unsigned long long hole_bytes;
+    unsigned long long hole_hist[M61_NSIZEBUCKETS]; // # holes by size
+    unsigned long long npages;          // # 4 KiB pages in regions
+    unsigned long long npages_used;     // # of those holding block bytes
+    unsigned long long occupancy_hist[M61_NOCCUPANCYBUCKETS];
 };
 
 void m61_getstatistics(struct m61_statistics* stats);
+void m61_getsizepeaks(unsigned long long* peak);
 void m61_printstatistics(void);
 void m61_printleakreport(void);
+void m61_printleaksummary(void);
+void m61_printleakjson(void);
+void m61_printheavyreport(void);
+void m61_getfragmentation(struct m61_fragmentation* frag, size_t max_blocks);
+void m61_printfragmentation(void);
+int m61_check_heap_step(size_t budget);
+void m61_setheavysampling(size_t interval);
+void m61_setsampling(size_t interval);
+void m61_setstackdepth(unsigned depth);
+int m61_setexport(const char* filename);
+void m61_sethistograms(int enabled);
+void m61_setquarantine(size_t limit);
+int m61_settrace(const char* filename);
+void m61_setleakcheck(int enabled);
+
+// Snapshots of the live heap by site, for finding slow leaks.
+struct m61_snapshot;
+struct m61_snapshot* m61_snapshot(void);
+void m61_snapshot_diff(const struct m61_snapshot* a, const struct m61_snapshot* b);
+void m61_snapshot_free(struct m61_snapshot* snap);
+
+// Arenas allocate blocks that are all freed at once by m61_arena_reset.
+typedef struct m61_arena m61_arena;
+m61_arena* m61_arena_create(void);
+void* m61_arena_malloc(m61_arena* arena, size_t sz, const char* file, int line);
+void m61_arena_reset(m61_arena* arena);
+void m61_arena_destroy(m61_arena* arena);
+void m61_arena_getstatistics(m61_arena* arena, struct m61_statistics* stats);
 
 #if !M61_DISABLE
 #define malloc(sz)              m61_malloc((sz), __FILE__, __LINE__)
 #define free(ptr)               m61_free((ptr), __FILE__, __LINE__)
 #define realloc(ptr, sz)        m61_realloc((ptr), (sz), __FILE__, __LINE__)
 #define calloc(nmemb, sz)       m61_calloc((nmemb), (sz), __FILE__, __LINE__)
+#define aligned_alloc(alignment, sz) m61_aligned_alloc((alignment), (sz), __FILE__, __LINE__)
+#define posix_memalign(memptr, alignment, sz) m61_posix_memalign((memptr), (alignment), (sz), __FILE__, __LINE__)
+#define arena_malloc(arena, sz) m61_arena_malloc((arena), (sz), __FILE__, __LINE__)
 #endif
 
 void* base_malloc(size_t sz);
 void base_free(void* ptr);
 void base_disablealloc(int is_disabled);
 
+#if M61_PRELOAD
+size_t m61_libc_usable_size(void* ptr);
+#endif
+
+void* slab_malloc(size_t sz, int* zeroed);
+int slab_free(void* ptr);
+size_t slab_usable_size(void* ptr);
+void slab_enablealloc(int is_enabled);
+void slab_forklock(int lock);
+
+void* guard_malloc(size_t sz, int* zeroed);
+int guard_free(void* ptr, const void* keep);
+size_t guard_usable_size(void* ptr);
+int guard_readable(const void* ptr, size_t len);
+void guard_setthreshold(size_t min_size);
+void guard_forklock(int lock);
+
 #endif
@@ -0,0 +1,386 @@
+#define _GNU_SOURCE 1
+#define M61_DISABLE 1
+#define M61_INTERPOSE 1
+#include "m61.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <malloc.h>
+
+// libm61.so: m61 for unmodified programs. This file replaces the C
+// library's malloc family with m61's, so
+//
+//     LD_PRELOAD=./libm61.so M61_OPTIONS=stats,leaks ./program
+//
+// checks and profiles `program` without rebuilding it. Each block's site
+// is the return address of its allocation call, which m61 symbolizes
+// only when a report prints it.
+//
+// M61_OPTIONS is a comma-separated list of:
+//    stats, leaks, leaksummary, leakjson, heavy, histograms, fragmentation
+//                      Print these reports to stderr at exit.
+//    log=FILE          Print reports at exit to FILE.PID instead, so each
+//                      process (exec'd programs included) has its own.
+//    children          Also print reports from forked children, which
+//                      otherwise print none.
+//    skip=N            Attribute blocks to the caller N frames further up,
+//                      skipping allocation wrappers. Needs frame pointers.
+//    stack=N           Same as m61_setstackdepth(N): also record N callers
+//                      above each block's site, and report by call stack.
+//    quarantine=BYTES  Same as m61_setquarantine(BYTES).
+//    sampling=BYTES    Same as m61_setheavysampling(BYTES).
+//    sample=BYTES      Same as m61_setsampling(BYTES): fully check and
+//                      track only about one allocated byte in BYTES.
+//    slab              Use the size-class allocator for small blocks.
+//    guard=BYTES       Put blocks of at least BYTES before guard pages.
+//    export=FILE       Same as m61_setexport(FILE).
+//
+// Blocks the guard-page and size-class allocators do not take come
+// straight from the C library, not from the base allocator, which never
+// gives memory back and would grow without bound under a long-running
+// program. A freed block may then be reused by the C library at once,
+// so a double free can be reported as an invalid free rather than as a
+// double free; the quarantine option keeps freed blocks for longer.
+//
+// Memory allocated while m61 prints its exit reports (stdio buffers, for
+// instance) comes from the C library, since m61 holds its own locks at
+// that point. Such "foreign" blocks are remembered in a small set so free
+// can send them back.
+
+void* __libc_malloc(size_t sz);
+void __libc_free(void* ptr);
+void* __libc_realloc(void* ptr, size_t sz);
+void* __libc_calloc(size_t nmemb, size_t sz);
+void* __libc_memalign(size_t alignment, size_t sz);
+
+static unsigned preload_skip;
+static int preload_reports;     // bitmask of PRELOAD_* reports
+static int preload_children;    // report from forked children too
+static pid_t preload_pid;       // process that loaded the library
+static char preload_log[1024];
+static __thread int preload_busy;
+static size_t (*libc_usable_size)(void*);
+
+#define PRELOAD_STATS       1
+#define PRELOAD_LEAKS       2
+#define PRELOAD_HEAVY       4
+#define PRELOAD_LEAKSUMMARY 8
+#define PRELOAD_LEAKJSON    16
+#define PRELOAD_FRAGMENTATION 32
+
+
+// Foreign blocks.
+
+static void** foreign;          // open-addressed set; NULL is empty
+static size_t foreign_capacity;
+static size_t nforeign;
+static pthread_mutex_t foreign_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline size_t foreign_home(void* ptr) {
+    return ((uintptr_t) ptr * 0x9E3779B97F4A7C15ULL) >> 20;
+}
+
+static void foreign_add(void* ptr) {
+    if (!ptr)
+        return;
+    pthread_mutex_lock(&foreign_lock);
+    if (2 * (nforeign + 1) > foreign_capacity) {
+        void** old = foreign;
+        size_t old_capacity = foreign_capacity;
+        foreign_capacity = old_capacity ? old_capacity * 2 : 64;
+        foreign = __libc_calloc(foreign_capacity, sizeof(void*));
+        if (!foreign)
+            abort();
+        for (size_t i = 0; i < old_capacity; ++i)
+            if (old[i]) {
+                size_t j = foreign_home(old[i]);
+                while (foreign[j & (foreign_capacity - 1)])
+                    ++j;
+                foreign[j & (foreign_capacity - 1)] = old[i];
+            }
+        __libc_free(old);
+    }
+    size_t j = foreign_home(ptr);
+    while (foreign[j & (foreign_capacity - 1)])
+        ++j;
+    foreign[j & (foreign_capacity - 1)] = ptr;
+    __atomic_store_n(&nforeign, nforeign + 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&foreign_lock);
+}
+
+/// foreign_remove(ptr)
+///    If `ptr` is a foreign block, forget it and return 1.
+
+static int foreign_remove(void* ptr) {
+    if (!ptr || !__atomic_load_n(&nforeign, __ATOMIC_RELAXED))
+        return 0;
+    pthread_mutex_lock(&foreign_lock);
+    size_t mask = foreign_capacity - 1;
+    size_t i = foreign_home(ptr);
+    while (foreign[i & mask] && foreign[i & mask] != ptr)
+        ++i;
+    int found = foreign[i & mask] != NULL;
+    if (found) {
+        // backward-shift deletion keeps probe sequences unbroken
+        size_t j = i;
+        while (foreign[++j & mask]) {
+            size_t home = foreign_home(foreign[j & mask]);
+            if (((j - home) & mask) >= ((j - i) & mask)) {
+                foreign[i & mask] = foreign[j & mask];
+                i = j;
+            }
+        }
+        foreign[i & mask] = NULL;
+        __atomic_store_n(&nforeign, nforeign - 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&foreign_lock);
+    return found;
+}
+
+
+// Call sites.
+
+/// preload_unwind(fp, skip)
+///    Return the return address `skip` frames above the frame whose frame
+///    pointer is `fp`, following saved frame pointers. Stops at the last
+///    plausible frame if the chain looks broken: saved frame pointers
+///    must be aligned and move up the stack by less than 1 MiB per frame.
+
+static const void* __attribute__((noinline)) preload_unwind(void** fp, unsigned skip) {
+    const void* pc = fp[1];
+    for (unsigned i = 0; i < skip; ++i) {
+        void** next = (void**) fp[0];
+        if (next <= fp || ((uintptr_t) next & 7)
+            || (char*) next - (char*) fp > (1 << 20) || !next[1])
+            break;
+        fp = next;
+        pc = fp[1];
+    }
+    return pc;
+}
+
+#define PRELOAD_CALLER() \
+    ((const char*) (preload_skip                                        \
+                    ? preload_unwind(__builtin_frame_address(0), preload_skip) \
+                    : __builtin_return_address(0)))
+
+
+// Entry points.
+
+void* malloc(size_t sz) {
+    if (preload_busy) {
+        void* ptr = __libc_malloc(sz);
+        foreign_add(ptr);
+        return ptr;
+    }
+    return m61_malloc(sz, PRELOAD_CALLER(), M61_PCLINE);
+}
+
+void free(void* ptr) {
+    if (foreign_remove(ptr))
+        __libc_free(ptr);
+    else
+        m61_free(ptr, PRELOAD_CALLER(), M61_PCLINE);
+}
+
+void* realloc(void* ptr, size_t sz) {
+    if (foreign_remove(ptr)) {
+        void* new_ptr = __libc_realloc(ptr, sz);
+        foreign_add(new_ptr ? new_ptr : (sz ? ptr : NULL));
+        return new_ptr;
+    } else if (preload_busy && !ptr)
+        return malloc(sz);
+    return m61_realloc(ptr, sz, PRELOAD_CALLER(), M61_PCLINE);
+}
+
+void* calloc(size_t nmemb, size_t sz) {
+    if (preload_busy) {
+        void* ptr = __libc_calloc(nmemb, sz);
+        foreign_add(ptr);
+        return ptr;
+    }
+    return m61_calloc(nmemb, sz, PRELOAD_CALLER(), M61_PCLINE);
+}
+
+static void* preload_memalign(size_t alignment, size_t sz, const char* caller) {
+    if (preload_busy) {
+        void* ptr = __libc_memalign(alignment, sz);
+        foreign_add(ptr);
+        return ptr;
+    }
+    return m61_aligned_alloc(alignment, sz, caller, M61_PCLINE);
+}
+
+int posix_memalign(void** memptr, size_t alignment, size_t sz) {
+    if (alignment == 0 || alignment % sizeof(void*) != 0
+        || (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+    void* ptr = preload_memalign(alignment, sz, PRELOAD_CALLER());
+    if (!ptr && sz)
+        return ENOMEM;
+    *memptr = ptr;
+    return 0;
+}
+
+void* aligned_alloc(size_t alignment, size_t sz) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return preload_memalign(alignment, sz, PRELOAD_CALLER());
+}
+
+void* memalign(size_t alignment, size_t sz) {
+    // like glibc, treat 0 as no alignment and round odd alignments up
+    // to a power of two
+    if (alignment == 0)
+        alignment = 1;
+    while (alignment & (alignment - 1))
+        alignment = (alignment | (alignment - 1)) + 1;
+    return preload_memalign(alignment, sz, PRELOAD_CALLER());
+}
+
+void* valloc(size_t sz) {
+    return preload_memalign(sysconf(_SC_PAGESIZE), sz, PRELOAD_CALLER());
+}
+
+void* pvalloc(size_t sz) {
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+    return preload_memalign(pagesize, (sz + pagesize - 1) & ~(pagesize - 1),
+                            PRELOAD_CALLER());
+}
+
+size_t malloc_usable_size(void* ptr) {
+    if (!ptr)
+        return 0;
+    if (__atomic_load_n(&nforeign, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&foreign_lock);
+        size_t i = foreign_home(ptr);
+        while (foreign[i & (foreign_capacity - 1)]
+               && foreign[i & (foreign_capacity - 1)] != ptr)
+            ++i;
+        int found = foreign[i & (foreign_capacity - 1)] != NULL;
+        pthread_mutex_unlock(&foreign_lock);
+        if (found)
+            return m61_libc_usable_size(ptr);
+    }
+    return ((struct m61_statistics_metadata*) ptr - 1)->size;
+}
+
+/// m61_libc_usable_size(ptr)
+///    Return the C library's malloc_usable_size(ptr), or 0 before the
+///    library is initialized.
+
+size_t m61_libc_usable_size(void* ptr) {
+    return libc_usable_size ? libc_usable_size(ptr) : 0;
+}
+
+
+// Options and exit reports.
+
+static void __attribute__((constructor)) preload_init(void) {
+    libc_usable_size = (size_t (*)(void*)) dlsym(RTLD_NEXT, "malloc_usable_size");
+    preload_pid = getpid();
+    base_disablealloc(1);
+
+    const char* s = getenv("M61_OPTIONS");
+    while (s && *s) {
+        size_t len = strcspn(s, ",");
+        const char* eq = memchr(s, '=', len);
+        size_t namelen = eq ? (size_t) (eq - s) : len;
+        char value[1024] = "";
+        if (eq && (size_t) (s + len - eq - 1) < sizeof(value))
+            memcpy(value, eq + 1, s + len - eq - 1);
+#define OPTION(name) (namelen == strlen(name) && memcmp(s, name, namelen) == 0)
+        if (OPTION("stats"))
+            preload_reports |= PRELOAD_STATS;
+        else if (OPTION("leaks"))
+            preload_reports |= PRELOAD_LEAKS;
+        else if (OPTION("leaksummary"))
+            preload_reports |= PRELOAD_LEAKSUMMARY;
+        else if (OPTION("leakjson"))
+            preload_reports |= PRELOAD_LEAKJSON;
+        else if (OPTION("heavy"))
+            preload_reports |= PRELOAD_HEAVY;
+        else if (OPTION("fragmentation"))
+            preload_reports |= PRELOAD_FRAGMENTATION;
+        else if (OPTION("histograms")) {
+            preload_reports |= PRELOAD_STATS;
+            m61_sethistograms(1);
+        } else if (OPTION("log") && eq)
+            strcpy(preload_log, value);
+        else if (OPTION("children"))
+            preload_children = 1;
+        else if (OPTION("skip") && eq)
+            preload_skip = strtoul(value, NULL, 0);
+        else if (OPTION("stack") && eq)
+            m61_setstackdepth(strtoul(value, NULL, 0));
+        else if (OPTION("quarantine") && eq)
+            m61_setquarantine(strtoull(value, NULL, 0));
+        else if (OPTION("sampling") && eq)
+            m61_setheavysampling(strtoull(value, NULL, 0));
+        else if (OPTION("sample") && eq)
+            m61_setsampling(strtoull(value, NULL, 0));
+        else if (OPTION("guard") && eq)
+            guard_setthreshold(strtoull(value, NULL, 0));
+        else if (OPTION("slab"))
+            slab_enablealloc(1);
+        else if (OPTION("export") && eq) {
+            if (m61_setexport(value) != 0)
+                fprintf(stderr, "m61: cannot export statistics to %s\n", value);
+        } else if (len)
+            fprintf(stderr, "m61: unknown option %.*s\n", (int) len, s);
+#undef OPTION
+        s += len + (s[len] == ',');
+    }
+}
+
+/// preload_fini()
+///    Print the exit reports. They go to stderr or to a per-process log
+///    file, never to the program's stdout, which may be a pipe that
+///    another program reads (as in a shell's `$(...)`). stdout is
+///    pointed at the report's destination while m61 prints, then
+///    restored.
+
+static void __attribute__((destructor)) preload_fini(void) {
+    if (!preload_reports || (getpid() != preload_pid && !preload_children))
+        return;
+    preload_busy = 1;
+    fflush(stdout);
+    int fd = STDERR_FILENO;
+    if (preload_log[0]) {
+        char name[sizeof(preload_log) + 32];
+        snprintf(name, sizeof(name), "%s.%ld", preload_log, (long) getpid());
+        fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            fprintf(stderr, "m61: %s: %s\n", name, strerror(errno));
+            fd = STDERR_FILENO;
+        }
+    }
+    int saved_stdout = dup(STDOUT_FILENO);
+    dup2(fd, STDOUT_FILENO);
+    if (fd != STDERR_FILENO)
+        close(fd);
+    if (preload_reports & PRELOAD_STATS)
+        m61_printstatistics();
+    if (preload_reports & PRELOAD_LEAKS)
+        m61_printleakreport();
+    if (preload_reports & PRELOAD_LEAKSUMMARY)
+        m61_printleaksummary();
+    if (preload_reports & PRELOAD_LEAKJSON)
+        m61_printleakjson();
+    if (preload_reports & PRELOAD_HEAVY)
+        m61_printheavyreport();
+    if (preload_reports & PRELOAD_FRAGMENTATION)
+        m61_printfragmentation();
+    fflush(stdout);
+    if (saved_stdout >= 0) {
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(saved_stdout);
+    }
+    preload_busy = 0;
+}
@@ -0,0 +1,118 @@
+#define M61_DISABLE 1
+#include "m61.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/mman.h>
+// m61top: Watch the statistics of a running m61 program that exports
+// them with m61_setexport (or M61_EXPORT=FILE). The counters are read
+// with plain atomic loads, so the program is never stopped or locked.
+
+static void usage(void) {
+    printf("Usage: ./m61top [-i SECONDS] [-n COUNT] [-s] FILE\n\
+\n\
+  Every SECONDS (default 1), prints the active allocations of the\n\
+  program exporting to FILE and its allocation, free and byte rates.\n\
+  Stops after COUNT lines, or when the program exits.\n\
+  -s also prints the allocation size histogram for each interval.\n");
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Sum the shards of `x` into `sum`.
+static void collect(const struct m61_export* x, struct m61_counters* sum) {
+    memset(sum, 0, sizeof(*sum));
+    for (unsigned i = 0; i < x->nshards && i < M61_NSHARDS; ++i) {
+        const struct m61_counters* c = &x->shards[i];
+        sum->nactive += __atomic_load_n(&c->nactive, __ATOMIC_RELAXED);
+        sum->active_size += __atomic_load_n(&c->active_size, __ATOMIC_RELAXED);
+        sum->ntotal += __atomic_load_n(&c->ntotal, __ATOMIC_RELAXED);
+        sum->total_size += __atomic_load_n(&c->total_size, __ATOMIC_RELAXED);
+        sum->nfail += __atomic_load_n(&c->nfail, __ATOMIC_RELAXED);
+        sum->fail_size += __atomic_load_n(&c->fail_size, __ATOMIC_RELAXED);
+        for (int b = 0; b < M61_NSIZEBUCKETS; ++b)
+            sum->size_hist[b] += __atomic_load_n(&c->size_hist[b], __ATOMIC_RELAXED);
+    }
+}
+
+static void print_histogram(const struct m61_counters* cur,
+                            const struct m61_counters* prev, double dt) {
+    unsigned long long total = cur->ntotal - prev->ntotal;
+    for (int b = 0; b < M61_NSIZEBUCKETS; ++b) {
+        unsigned long long n = cur->size_hist[b] - prev->size_hist[b];
+        if (n == 0)
+            continue;
+        unsigned long long lo = b ? 1ULL << (b - 1) : 0;
+        printf("    size %10llu-%-10llu %12.0f/s %5.1f%%\n",
+               lo, b ? (lo << 1) - 1 : 0, n / dt, 100.0 * n / total);
+    }
+}
+
+int main(int argc, char** argv) {
+    double interval = 1;
+    long count = -1;
+    int histogram = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:n:sh")) != -1) {
+        if (opt == 'i')
+            interval = strtod(optarg, NULL);
+        else if (opt == 'n')
+            count = strtol(optarg, NULL, 0);
+        else if (opt == 's')
+            histogram = 1;
+        else {
+            usage();
+            exit(opt == 'h' ? 0 : 1);
+        }
+    }
+    if (optind != argc - 1 || interval <= 0) {
+        usage();
+        exit(1);
+    }
+
+    int fd = open(argv[optind], O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+        exit(1);
+    }
+    const struct m61_export* x = mmap(NULL, sizeof(struct m61_export),
+                                      PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (x == MAP_FAILED
+        || __atomic_load_n(&x->magic, __ATOMIC_ACQUIRE) != M61_EXPORT_MAGIC) {
+        fprintf(stderr, "%s: not an m61 statistics file\n", argv[optind]);
+        exit(1);
+    }
+
+    struct m61_counters prev, cur;
+    collect(x, &prev);
+    double prev_time = now();
+    printf("pid %ld\n%10s %14s %12s %12s %14s %8s\n", x->pid, "active",
+           "active bytes", "allocs/s", "frees/s", "bytes/s", "fails");
+    for (long line = 0; count < 0 || line < count; ++line) {
+        usleep((useconds_t) (interval * 1e6));
+        collect(x, &cur);
+        double t = now(), dt = t - prev_time;
+        unsigned long long nallocs = cur.ntotal - prev.ntotal;
+        unsigned long long nfrees = nallocs - (cur.nactive - prev.nactive);
+        printf("%10llu %14llu %12.0f %12.0f %14.0f %8llu\n",
+               cur.nactive, cur.active_size, nallocs / dt, nfrees / dt,
+               (cur.total_size - prev.total_size) / dt, cur.nfail);
+        if (histogram && nallocs)
+            print_histogram(&cur, &prev, dt);
+        fflush(stdout);
+        prev = cur;
+        prev_time = t;
+        if (kill(x->pid, 0) != 0 && errno == ESRCH)
+            break;
+    }
+}
@@ -0,0 +1,281 @@
+#define M61_DISABLE 1
+#include "m61.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+// replay61: Replay an allocation trace recorded with M61_TRACE=FILE (or
+// m61_settrace) against the system allocator and against m61, each in
+// a fresh process, and print throughput and peak resident set size.
+
+typedef struct replay_op {
+    unsigned op;                // M61_TRACE_*
+    unsigned id;                // block made (or freed), 0 if none
+    unsigned old_id;            // REALLOC: block resized, 0 if none
+    size_t size;
+    size_t arg;
+} replay_op;
+
+static replay_op* ops;
+static size_t nops;
+static unsigned nids = 1;       // block ids; 0 means none
+
+static void usage(void) {
+    printf("Usage: ./replay61 [-r REPEAT] [-s] TRACE\n\
+\n\
+  Replays TRACE, written by a program run with M61_TRACE=TRACE, first\n\
+  on the system allocator and then on m61, REPEAT times each (default\n\
+  1), and prints events per second and peak RSS.\n\
+  -s makes m61 use its size-class allocator.\n");
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+// Loading.
+//    Events are sorted by time (ties keep file order), and block
+//    addresses are renamed to dense ids, so replay is an array lookup.
+
+typedef struct sorted_event {
+    struct m61_trace_event ev;
+    size_t pos;
+} sorted_event;
+
+static int event_compare(const void* a, const void* b) {
+    const sorted_event* ea = a;
+    const sorted_event* eb = b;
+    if (ea->ev.time != eb->ev.time)
+        return ea->ev.time < eb->ev.time ? -1 : 1;
+    return ea->pos < eb->pos ? -1 : ea->pos > eb->pos;
+}
+
+typedef struct id_map {
+    uint64_t* addrs;            // open-addressed; 0 is empty
+    unsigned* ids;
+    size_t capacity;
+    size_t n;
+} id_map;
+
+static size_t id_slot(id_map* m, uint64_t addr) {
+    size_t i = (addr * 0x9E3779B97F4A7C15ULL) >> 17;
+    while (m->addrs[i & (m->capacity - 1)] && m->addrs[i & (m->capacity - 1)] != addr)
+        ++i;
+    return i & (m->capacity - 1);
+}
+
+// Return the id of live block `addr` and forget it, or 0 if unknown.
+static unsigned id_take(id_map* m, uint64_t addr) {
+    if (!addr)
+        return 0;
+    size_t i = id_slot(m, addr);
+    if (!m->addrs[i])
+        return 0;
+    unsigned id = m->ids[i];
+    m->ids[i] = 0;              // tombstone: keep the address
+    return id;
+}
+
+// Give live block `addr` a new id.
+static unsigned id_new(id_map* m, uint64_t addr) {
+    if (!addr)
+        return 0;
+    if (2 * (m->n + 1) > m->capacity) {
+        id_map old = *m;
+        m->capacity = old.capacity ? old.capacity * 2 : 1024;
+        m->addrs = calloc(m->capacity, sizeof(uint64_t));
+        m->ids = calloc(m->capacity, sizeof(unsigned));
+        if (!m->addrs || !m->ids)
+            abort();
+        for (size_t i = 0; i < old.capacity; ++i)
+            if (old.addrs[i]) {
+                size_t j = id_slot(m, old.addrs[i]);
+                m->addrs[j] = old.addrs[i];
+                m->ids[j] = old.ids[i];
+            }
+        free(old.addrs);
+        free(old.ids);
+    }
+    size_t i = id_slot(m, addr);
+    if (!m->addrs[i]) {
+        m->addrs[i] = addr;
+        ++m->n;
+    }
+    m->ids[i] = nids;
+    return nids++;
+}
+
+static void load(const char* filename) {
+    FILE* f = fopen(filename, "rb");
+    struct m61_trace_header h;
+    if (!f || fread(&h, sizeof(h), 1, f) != 1 || h.magic != M61_TRACE_MAGIC
+        || h.event_size != sizeof(struct m61_trace_event)) {
+        fprintf(stderr, "%s: not an m61 trace\n", filename);
+        exit(1);
+    }
+    size_t n = 0, capacity = 0;
+    sorted_event* evs = NULL;
+    struct m61_trace_event ev;
+    while (fread(&ev, sizeof(ev), 1, f) == 1) {
+        if (n == capacity) {
+            capacity = capacity ? capacity * 2 : 4096;
+            evs = realloc(evs, capacity * sizeof(sorted_event));
+            if (!evs)
+                abort();
+        }
+        evs[n].ev = ev;
+        evs[n].pos = n;
+        ++n;
+    }
+    fclose(f);
+    qsort(evs, n, sizeof(sorted_event), event_compare);
+
+    id_map m = {NULL, NULL, 0, 0};
+    ops = calloc(n ? n : 1, sizeof(replay_op));
+    if (!ops)
+        abort();
+    for (size_t i = 0; i < n; ++i) {
+        struct m61_trace_event* e = &evs[i].ev;
+        replay_op* op = &ops[nops];
+        op->op = e->op;
+        op->size = e->size;
+        op->arg = e->arg;
+        op->old_id = 0;
+        if (e->op == M61_TRACE_FREE) {
+            if (!(op->id = id_take(&m, e->ptr)))
+                continue;       // allocated before tracing started
+        } else {
+            if (e->op == M61_TRACE_REALLOC)
+                op->old_id = id_take(&m, e->arg);
+            op->id = id_new(&m, e->ptr);
+        }
+        ++nops;
+    }
+    free(evs);
+    free(m.addrs);
+    free(m.ids);
+}
+
+
+// Replay.
+
+static void run(int use_m61, void** ptrs) {
+    for (size_t i = 0; i < nops; ++i) {
+        replay_op* op = &ops[i];
+        char* p = NULL;
+        size_t sz = op->size;
+        switch (op->op) {
+        case M61_TRACE_MALLOC:
+            p = use_m61 ? m61_malloc(op->size, __FILE__, __LINE__) : malloc(op->size);
+            break;
+        case M61_TRACE_FREE:
+            if (use_m61)
+                m61_free(ptrs[op->id], __FILE__, __LINE__);
+            else
+                free(ptrs[op->id]);
+            ptrs[op->id] = NULL;
+            continue;
+        case M61_TRACE_REALLOC:
+            p = use_m61 ? m61_realloc(ptrs[op->old_id], op->size, __FILE__, __LINE__)
+                : realloc(ptrs[op->old_id], op->size);
+            ptrs[op->old_id] = NULL;
+            break;
+        case M61_TRACE_CALLOC:
+            p = use_m61 ? m61_calloc(op->arg, op->size, __FILE__, __LINE__)
+                : calloc(op->arg, op->size);
+            sz *= op->arg;
+            break;
+        case M61_TRACE_ALIGNED:
+            p = use_m61 ? m61_aligned_alloc(op->arg, op->size, __FILE__, __LINE__)
+                : aligned_alloc(op->arg, op->size);
+            break;
+        }
+        // touch both ends, as m61's header and tail canary do
+        if (p && sz) {
+            p[0] = 1;
+            p[sz - 1] = 1;
+        }
+        ptrs[op->id] = p;
+    }
+}
+
+// Run the replay `repeat` times in a child process. Returns the elapsed
+// seconds and sets `*maxrss` to the child's peak RSS in KiB.
+static double replay(int use_m61, int slab, int repeat, long* maxrss) {
+    int pfd[2];
+    if (pipe(pfd) != 0) {
+        perror("pipe");
+        exit(1);
+    }
+    pid_t p = fork();
+    if (p == 0) {
+        close(pfd[0]);
+        slab_enablealloc(slab);
+        void** ptrs = calloc(nids, sizeof(void*));
+        double start = now();
+        for (int r = 0; r < repeat; ++r) {
+            run(use_m61, ptrs);
+            for (unsigned id = 0; id < nids; ++id)
+                if (ptrs[id]) {
+                    if (use_m61)
+                        m61_free(ptrs[id], __FILE__, __LINE__);
+                    else
+                        free(ptrs[id]);
+                    ptrs[id] = NULL;
+                }
+        }
+        double elapsed = now() - start;
+        ssize_t w = write(pfd[1], &elapsed, sizeof(elapsed));
+        _exit(w == sizeof(elapsed) ? 0 : 1);
+    }
+    close(pfd[1]);
+    double elapsed = -1;
+    if (read(pfd[0], &elapsed, sizeof(elapsed)) != sizeof(elapsed))
+        elapsed = -1;
+    close(pfd[0]);
+    int status;
+    struct rusage ru;
+    wait4(p, &status, 0, &ru);
+    *maxrss = ru.ru_maxrss;
+    return elapsed;
+}
+
+int main(int argc, char** argv) {
+    int repeat = 1, slab = 0, opt;
+    while ((opt = getopt(argc, argv, "r:sh")) != -1) {
+        if (opt == 'r')
+            repeat = strtol(optarg, NULL, 0);
+        else if (opt == 's')
+            slab = 1;
+        else {
+            usage();
+            exit(opt == 'h' ? 0 : 1);
+        }
+    }
+    if (optind != argc - 1 || repeat < 1) {
+        usage();
+        exit(1);
+    }
+    m61_settrace(NULL);         // don't trace the replay itself
+
+    load(argv[optind]);
+    printf("%zu events, %u blocks\n", nops, nids - 1);
+    printf("%-10s %15s %12s %14s\n", "allocator", "events/s", "ns/event", "peak RSS KiB");
+    for (int use_m61 = 0; use_m61 < 2; ++use_m61) {
+        long maxrss;
+        double elapsed = replay(use_m61, slab, repeat, &maxrss);
+        if (elapsed < 0) {
+            fprintf(stderr, "replay on %s failed\n", use_m61 ? "m61" : "system");
+            exit(1);
+        }
+        double n = (double) nops * repeat;
+        printf("%-10s %15.0f %12.1f %14ld\n", use_m61 ? "m61" : "system",
+               n / elapsed, elapsed * 1e9 / n, maxrss);
+    }
+}
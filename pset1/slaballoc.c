@@ -0,0 +1,193 @@
+#define M61_DISABLE 1
+#include "m61.h"
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+
+// This file contains a size-class ("slab") allocator that m61 can use
+// instead of base_malloc for small blocks.
+//
+// Memory comes from one reserved arena carved into SLAB_PAGESIZE pages.
+// Each page holds fixed-size slots of a single size class. All metadata
+// lives out of line: the class of each page is in `page_class`, and each
+// class keeps a stack of free slot addresses, so freed slots are never
+// written to (m61 relies on freed headers keeping their 0x0DEADBEEF mark).
+// Allocation and free are a stack pop and push. Slots carved from a new
+// page are still zero, since the arena is fresh anonymous memory; they
+// sit on the stacks with their low bit set, so slab_malloc can tell
+// calloc that they need no clearing.
+//
+// Each thread also caches up to SLAB_CACHESIZE free slots per class, so
+// most allocations and frees touch no shared state. A thread's cache
+// refills from, and spills to, the shared class stacks half a cache at a
+// time under `slab_lock`, and is flushed when the thread exits.
+
+#define SLAB_PAGESIZE   65536
+#define SLAB_ARENASIZE  ((size_t) 1 << 30)
+#define SLAB_NPAGES     (SLAB_ARENASIZE / SLAB_PAGESIZE)
+#define SLAB_MAXSIZE    2048
+#define SLAB_CACHESIZE  64
+
+typedef struct slab_class {
+    size_t sz;                  // slot size
+    char* next;                 // next never-used slot in current page
+    char* end;                  // end of current page
+    void** frees;               // stack of freed slots
+    size_t nfrees;
+    size_t free_capacity;
+} slab_class;
+
+// Slot sizes are multiples of 16 so payloads stay aligned; classes grow
+// by about 25% to bound internal fragmentation.
+static const size_t slot_sizes[] = {
+    16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256,
+    320, 384, 448, 512, 640, 768, 896, 1024, 1280, 1536, 1792, 2048
+};
+#define SLAB_NCLASSES   (sizeof(slot_sizes) / sizeof(slot_sizes[0]))
+
+static slab_class classes[SLAB_NCLASSES];
+typedef struct slab_cache {
+    unsigned n[SLAB_NCLASSES];
+    void* slots[SLAB_NCLASSES][SLAB_CACHESIZE];
+    int registered;
+} slab_cache;
+
+static unsigned char size_class[SLAB_MAXSIZE / 16 + 1]; // (sz+15)/16 -> class
+static unsigned char page_class[SLAB_NPAGES];
+static char* arena;
+static char* arena_next;
+static int enabled;
+static pthread_mutex_t slab_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread slab_cache cache;
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+
+static int slab_init(void) {
+    pthread_mutex_lock(&slab_lock);
+    if (!arena) {
+        void* p = mmap(NULL, SLAB_ARENASIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED) {
+            enabled = 0;
+            pthread_mutex_unlock(&slab_lock);
+            return 0;
+        }
+        unsigned c = 0;
+        for (size_t i = 0; i <= SLAB_MAXSIZE / 16; ++i) {
+            while (slot_sizes[c] < i * 16)
+                ++c;
+            size_class[i] = c;
+        }
+        for (c = 0; c < SLAB_NCLASSES; ++c)
+            classes[c].sz = slot_sizes[c];
+        arena_next = p;
+        __atomic_store_n(&arena, (char*) p, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&slab_lock);
+    return 1;
+}
+
+static inline int slab_owns(const void* ptr) {
+    return arena && (const char*) ptr >= arena
+        && (const char*) ptr < arena + SLAB_ARENASIZE;
+}
+
+// Move the `n` oldest slots of class `c` from `sc` to the shared stack.
+static void slab_spill(slab_cache* sc, unsigned c, unsigned n) {
+    slab_class* cl = &classes[c];
+    pthread_mutex_lock(&slab_lock);
+    if (cl->nfrees + n > cl->free_capacity) {
+        while (cl->nfrees + n > cl->free_capacity)
+            cl->free_capacity = cl->free_capacity ? cl->free_capacity * 2 : 256;
+        cl->frees = realloc(cl->frees, cl->free_capacity * sizeof(void*));
+        if (!cl->frees)
+            abort();
+    }
+    memcpy(&cl->frees[cl->nfrees], sc->slots[c], n * sizeof(void*));
+    cl->nfrees += n;
+    pthread_mutex_unlock(&slab_lock);
+    sc->n[c] -= n;
+    memmove(sc->slots[c], &sc->slots[c][n], sc->n[c] * sizeof(void*));
+}
+
+static void slab_cache_flush(void* arg) {
+    slab_cache* sc = arg;
+    for (unsigned c = 0; c < SLAB_NCLASSES; ++c)
+        if (sc->n[c])
+            slab_spill(sc, c, sc->n[c]);
+}
+
+static void slab_make_key(void) {
+    pthread_key_create(&cache_key, slab_cache_flush);
+}
+
+// Fill half of this thread's cache for class `c`, reusing freed slots
+// before carving new ones. Returns 0 if the arena is exhausted.
+static int slab_refill(unsigned c) {
+    if (!cache.registered) {
+        pthread_once(&cache_key_once, slab_make_key);
+        pthread_setspecific(cache_key, &cache);
+        cache.registered = 1;
+    }
+    slab_class* cl = &classes[c];
+    pthread_mutex_lock(&slab_lock);
+    while (cache.n[c] < SLAB_CACHESIZE / 2) {
+        if (cl->nfrees)
+            cache.slots[c][cache.n[c]++] = cl->frees[--cl->nfrees];
+        else {
+            if (cl->next == cl->end) {
+                if (arena_next == arena + SLAB_ARENASIZE)
+                    break;
+                page_class[(arena_next - arena) / SLAB_PAGESIZE] = c;
+                cl->next = arena_next;
+                cl->end = arena_next + SLAB_PAGESIZE - SLAB_PAGESIZE % cl->sz;
+                arena_next += SLAB_PAGESIZE;
+            }
+            cache.slots[c][cache.n[c]++] = cl->next + 1;   // fresh
+            cl->next += cl->sz;
+        }
+    }
+    pthread_mutex_unlock(&slab_lock);
+    return cache.n[c] != 0;
+}
+
+void* slab_malloc(size_t sz, int* zeroed) {
+    if (!enabled || sz > SLAB_MAXSIZE
+        || (!__atomic_load_n(&arena, __ATOMIC_ACQUIRE) && !slab_init()))
+        return NULL;
+    unsigned c = size_class[(sz + 15) / 16];
+    if (!cache.n[c] && !slab_refill(c))
+        return NULL;
+    uintptr_t slot = (uintptr_t) cache.slots[c][--cache.n[c]];
+    *zeroed = slot & 1;
+    return (void*) (slot & ~(uintptr_t) 1);
+}
+
+int slab_free(void* ptr) {
+    if (!slab_owns(ptr))
+        return 0;
+    unsigned c = page_class[((char*) ptr - arena) / SLAB_PAGESIZE];
+    if (cache.n[c] == SLAB_CACHESIZE)
+        slab_spill(&cache, c, SLAB_CACHESIZE / 2);
+    cache.slots[c][cache.n[c]++] = ptr;
+    return 1;
+}
+
+size_t slab_usable_size(void* ptr) {
+    if (!slab_owns(ptr))
+        return 0;
+    return classes[page_class[((char*) ptr - arena) / SLAB_PAGESIZE]].sz;
+}
+
+void slab_enablealloc(int is_enabled) {
+    enabled = is_enabled;
+}
+
+void slab_forklock(int lock) {
+    if (lock)
+        pthread_mutex_lock(&slab_lock);
+    else
+        pthread_mutex_unlock(&slab_lock);
+}
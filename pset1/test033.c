@@ -0,0 +1,42 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+// Statistics stay exact when several threads allocate and free at once,
+// including blocks freed by a different thread than allocated them.
+
+#define NTHREADS 4
+
+static void* ptrs[NTHREADS][10];
+
+static void* thread_main(void* arg) {
+    int t = (int) (long) arg;
+    for (int i = 0; i < 10000; ++i) {
+        char* p = (char*) malloc(i % 200 + 1);
+        p[0] = t;
+        free(p);
+    }
+    for (int i = 0; i < 10; ++i)
+        ptrs[t][i] = malloc(100);
+    return NULL;
+}
+
+int main() {
+    slab_enablealloc(1);
+    pthread_t threads[NTHREADS];
+    for (long t = 0; t < NTHREADS; ++t)
+        pthread_create(&threads[t], NULL, thread_main, (void*) t);
+    for (int t = 0; t < NTHREADS; ++t)
+        pthread_join(threads[t], NULL);
+    m61_printstatistics();
+    for (int t = 0; t < NTHREADS; ++t)
+        for (int i = 0; i < 5; ++i)
+            free(ptrs[t][i]);
+    m61_printstatistics();
+}
+
+//! malloc count: active         40   total      40040   fail          0
+//! malloc size:  active       4000   total    4024000   fail          0
+//! malloc count: active         20   total      40040   fail          0
+//! malloc size:  active       2000   total    4024000   fail          0
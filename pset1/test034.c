@@ -0,0 +1,20 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Heavy hitter report lists sites with at least 10% of allocated bytes.
+
+int main() {
+    for (int i = 0; i < 10000; ++i)
+        free(malloc(1));
+    for (int i = 0; i < 1000; ++i)
+        free(malloc(1000));
+    for (int i = 0; i < 100; ++i)
+        free(malloc(1000));
+    for (int i = 0; i < 200; ++i)
+        free(malloc(1000));
+    m61_printheavyreport();
+}
+
+//! HEAVY HITTER: test???.c:11: 1000000 bytes (~76.3%) in 1000 allocations
+//! HEAVY HITTER: test???.c:15: 200000 bytes (~15.3%) in 200 allocations
@@ -0,0 +1,39 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+// Exported statistics are visible through a separate mapping of the file.
+
+int main() {
+    void* early = malloc(100);
+    char filename[] = "/tmp/test035.XXXXXX";
+    int fd = mkstemp(filename);
+    assert(fd >= 0);
+    assert(m61_setexport(filename) == 0);
+    struct m61_export* x = (struct m61_export*) mmap(NULL, sizeof(*x),
+                                                     PROT_READ, MAP_SHARED, fd, 0);
+    assert(x != MAP_FAILED);
+    close(fd);
+    unlink(filename);
+
+    for (int i = 0; i < 10; ++i)
+        free(malloc(3000));
+    free(early);
+
+    unsigned long long ntotal = 0, total_size = 0, nactive = 0, bucket = 0;
+    for (unsigned i = 0; i < x->nshards; ++i) {
+        ntotal += x->shards[i].ntotal;
+        total_size += x->shards[i].total_size;
+        nactive += x->shards[i].nactive;
+        bucket += x->shards[i].size_hist[12];
+    }
+    printf("magic %x pid %s\n", x->magic, x->pid == getpid() ? "ok" : "wrong");
+    printf("active %llu total %llu size %llu 2048-4095 %llu\n",
+           nactive, ntotal, total_size, bucket);
+}
+
+//! magic 6d363174 pid ok
+//! active 0 total 11 size 30100 2048-4095 10
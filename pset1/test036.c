@@ -0,0 +1,33 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Size histograms in m61_printstatistics.
+
+int main() {
+    m61_sethistograms(1);
+    void* ptrs[10];
+    for (int i = 0; i < 10; ++i)
+        ptrs[i] = malloc(1 << i);
+    for (int i = 0; i < 10; i += 3)
+        free(ptrs[i]);
+    free(malloc(1000));
+    m61_printstatistics();
+}
+
+//! malloc count: active          6   total         11   fail          0
+//! malloc size:  active        438   total       2023   fail          0
+//! realloc count:      total          0   in place          0
+//! size histogram:           malloc       free
+//!            1-1                   1          1
+//!            2-3                   1          0
+//!            4-7                   1          0
+//!            8-15                  1          1
+//!           16-31                  1          0
+//!           32-63                  1          0
+//!           64-127                 1          1
+//!          128-255                 1          0
+//!          256-511                 1          0
+//!          512-1023                2          2
+//! latency histogram (cycles, 1/8 sampled): malloc       free
+//! ???
@@ -0,0 +1,27 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Realloc shrinks in place and grows in place into backend slack.
+
+int main() {
+    slab_enablealloc(1);     // 100-byte blocks get 108 usable bytes
+    char* p = (char*) malloc(100);
+    memset(p, 'x', 100);
+    char* q = (char*) realloc(p, 108);
+    assert(q == p);
+    q = (char*) realloc(q, 50);
+    assert(q == p && q[49] == 'x');
+    q = (char*) realloc(q, 200);
+    assert(q != p && q[49] == 'x');
+    free(q);
+
+    struct m61_statistics stat;
+    m61_getstatistics(&stat);
+    printf("realloc %llu in place %llu\n", stat.nrealloc, stat.nrealloc_inplace);
+    m61_printstatistics();
+}
+
+//! realloc 3 in place 2
+//! malloc count: active          0   total          4   fail          0
+//! malloc size:  active          0   total        458   fail          0
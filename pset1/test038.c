@@ -0,0 +1,15 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Boundary write error caught by an in-place realloc.
+
+int main() {
+    char* p = (char*) malloc(10);
+    p[10] = 'x';
+    p = (char*) realloc(p, 5);
+    m61_printstatistics();
+}
+
+//! MEMORY BUG???: detected wild write during free of pointer ???
+//! ???
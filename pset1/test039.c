@@ -0,0 +1,20 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Use-after-free write caught by the quarantine.
+
+int main() {
+    m61_setquarantine(1 << 20);
+    char* p = (char*) malloc(100);
+    char* q = (char*) malloc(100);
+    free(p);
+    free(q);
+    p[20] = 'x';
+    m61_setquarantine(0);
+    m61_printstatistics();
+}
+
+//! MEMORY BUG: test???.c:11: use after free: ??? is 20 bytes inside a 100 byte region freed here
+//!   test???.c:9: region was allocated here
+//! ???
@@ -0,0 +1,22 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Quarantined blocks are not reused; untouched ones release cleanly.
+
+int main() {
+    m61_setquarantine(1000);
+    char* p = (char*) malloc(100);
+    free(p);
+    for (int i = 0; i < 100; ++i) {
+        char* q = (char*) malloc(100);
+        assert(q != p || i >= 8);
+        memset(q, 0, 100);
+        free(q);
+    }
+    m61_setquarantine(0);
+    m61_printstatistics();
+}
+
+//! malloc count: active          0   total        101   fail          0
+//! malloc size:  active          0   total      10100   fail          0
@@ -0,0 +1,38 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Arena blocks appear in the statistics and leak report until a reset.
+
+int main() {
+    m61_arena* arena = m61_arena_create();
+    for (int i = 0; i < 1000; ++i) {
+        char* p = (char*) arena_malloc(arena, i % 100 + 1);
+        memset(p, 'A', i % 100 + 1);
+    }
+    char* big = (char*) arena_malloc(arena, 100000);
+    memset(big, 'B', 100000);
+    void* ptr = malloc(10);
+    m61_printstatistics();
+
+    struct m61_statistics stats;
+    m61_arena_getstatistics(arena, &stats);
+    assert(stats.nactive == 1001 && stats.active_size == 150500);
+
+    m61_arena_reset(arena);
+    arena_malloc(arena, 20);
+    m61_printstatistics();
+    m61_printleakreport();
+    m61_arena_destroy(arena);
+    free(ptr);
+    m61_printstatistics();
+}
+
+//! malloc count: active       1002   total       1002   fail          0
+//! malloc size:  active     150510   total     150510   fail          0
+//! malloc count: active          2   total       1003   fail          0
+//! malloc size:  active         30   total     150530   fail          0
+//! LEAK CHECK: test???.c:15: allocated object ??? with size 10
+//! LEAK CHECK: test???.c:23: allocated object ??? with size 20
+//! malloc count: active          0   total       1003   fail          0
+//! malloc size:  active          0   total     150530   fail          0
@@ -0,0 +1,15 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Arena blocks cannot be freed one at a time.
+
+int main() {
+    m61_arena* arena = m61_arena_create();
+    void* ptr = arena_malloc(arena, 32);
+    free(ptr);
+    m61_printstatistics();
+}
+
+//! MEMORY BUG: test???.c:10: invalid free of pointer ???, allocated in an arena
+//! ???
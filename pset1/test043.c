@@ -0,0 +1,25 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Leak summary groups active blocks by site, largest first.
+
+static void* leak(size_t sz) {
+    return malloc(sz);
+}
+
+int main() {
+    for (int i = 0; i < 1000; ++i)
+        leak(10);
+    for (int i = 0; i < 10; ++i)
+        (void) malloc(2000);
+    free(malloc(100000));
+    m61_arena* arena = m61_arena_create();
+    arena_malloc(arena, 5);
+    m61_printleaksummary();
+}
+
+//! LEAK SUMMARY: test???.c:15: 20000 bytes in 10 objects
+//! LEAK SUMMARY: test???.c:8: 10000 bytes in 1000 objects
+//! LEAK SUMMARY: test???.c:18: 5 bytes in 1 objects
+//! LEAK SUMMARY: total 30005 bytes in 1011 objects from 3 sites
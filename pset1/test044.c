@@ -0,0 +1,16 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// JSON leak summary.
+
+int main() {
+    for (int i = 0; i < 3; ++i)
+        (void) malloc(7);
+    (void) malloc(100);
+    m61_printleakjson();
+}
+
+//! {"bytes": 121, "count": 4, "sites": [
+//!   {"site": "test???.c:10", "bytes": 100, "count": 1},
+//!   {"site": "test???.c:9", "bytes": 21, "count": 3}]}
@@ -0,0 +1,29 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+// Guard pages catch a large-block overflow when it happens.
+
+static void on_segv(int sig) {
+    (void) sig;
+    const char msg[] = "overflow faulted\n";
+    write(STDOUT_FILENO, msg, sizeof(msg) - 1);
+    _exit(0);
+}
+
+int main() {
+    guard_setthreshold(4096);
+    signal(SIGSEGV, on_segv);
+    char* p = (char*) malloc(10000);
+    memset(p, 0, 10000);
+    printf("in bounds ok\n");
+    fflush(stdout);
+    for (int i = 10000; i < 10100; ++i)
+        p[i] = 1;
+    printf("overflow not caught\n");
+}
+
+//! in bounds ok
+//! overflow faulted
@@ -0,0 +1,32 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Guard-page spans are recycled, and small blocks do not use them.
+
+int main() {
+    guard_setthreshold(4096);
+    char* first = (char*) malloc(20000);
+    free(first);
+    int reused = 0;
+    for (int i = 0; i < 1000; ++i) {
+        char* p = (char*) malloc(20000 - i % 10);
+        reused += p == first;
+        p[20000 - i % 10 - 1] = 'x';
+        char* q = (char*) malloc(100);
+        assert(guard_usable_size(q) == 0);
+        free(q);
+        free(p);
+    }
+    assert(reused > 0);
+
+    // in-place realloc can grow into the span's slack
+    char* p = (char*) malloc(5000);
+    assert(guard_usable_size(p - 16) > 0);
+    p = (char*) realloc(p, 5010);
+    free(p);
+    m61_printstatistics();
+}
+
+//! malloc count: active          0   total       2003   fail          0
+//! malloc size:  active          0   total ??? fail          0
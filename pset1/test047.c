@@ -0,0 +1,38 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+// Aligned allocation.
+
+int main() {
+    void* ptrs[10];
+    for (int i = 0; i < 10; ++i) {
+        size_t align = (size_t) 8 << i;     // 8 ... 4096
+        ptrs[i] = aligned_alloc(align, 100 + i);
+        assert(ptrs[i] && (uintptr_t) ptrs[i] % align == 0);
+        memset(ptrs[i], 'A', 100 + i);
+    }
+    void* p;
+    assert(posix_memalign(&p, 64, 1000) == 0 && (uintptr_t) p % 64 == 0);
+    assert(posix_memalign(&p, 12, 1000) == EINVAL);
+    assert(posix_memalign(&p, 4, 1000) == EINVAL);
+    assert(posix_memalign(&p, 0, 1000) == EINVAL);
+    assert(aligned_alloc(48, 10) == NULL && errno == EINVAL);
+
+    // an aligned block can shrink in place and keeps its alignment
+    void* q = realloc(ptrs[9], 50);
+    assert(q == ptrs[9]);
+    m61_printleaksummary();
+    for (int i = 0; i < 10; ++i)
+        free(ptrs[i]);
+    free(p);
+    m61_printstatistics();
+}
+
+//! LEAK SUMMARY: test???.c:17: 1000 bytes in 1 objects
+//! LEAK SUMMARY: test???.c:12: 936 bytes in 9 objects
+//! LEAK SUMMARY: test???.c:24: 50 bytes in 1 objects
+//! LEAK SUMMARY: total 1986 bytes in 11 objects from 3 sites
+//! malloc count: active          0   total         12   fail          0
+//! malloc size:  active          0   total       2095   fail          0
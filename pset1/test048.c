@@ -0,0 +1,15 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Double free of an aligned block.
+
+int main() {
+    void* ptr = aligned_alloc(256, 300);
+    free(ptr);
+    free(ptr);
+    m61_printstatistics();
+}
+
+//! MEMORY BUG: test???.c:10: invalid free of pointer ???, double free ya dingus
+//! ???
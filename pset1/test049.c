@@ -0,0 +1,50 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Allocation tracing.
+
+static const char* const names[] = {
+    "?", "malloc", "free", "realloc", "calloc", "aligned"
+};
+
+int main() {
+    const char* filename = "test049.trace";
+    remove(filename);
+    assert(m61_settrace(filename) == 0);
+    char* a = malloc(100);
+    char* b = calloc(10, 20);
+    char* c = realloc(a, 200);
+    void* d = aligned_alloc(64, 64);
+    free(b);
+    free(c);
+    free(d);
+    m61_settrace(NULL);
+    free(malloc(1));            // not traced
+
+    FILE* f = fopen(filename, "rb");
+    assert(f);
+    struct m61_trace_header h;
+    assert(fread(&h, sizeof(h), 1, f) == 1);
+    assert(h.magic == M61_TRACE_MAGIC && h.event_size == sizeof(struct m61_trace_event));
+    struct m61_trace_event ev;
+    uint64_t last_time = 0;
+    while (fread(&ev, sizeof(ev), 1, f) == 1) {
+        assert(ev.time >= last_time);
+        last_time = ev.time;
+        if (ev.op == M61_TRACE_REALLOC)
+            assert(ev.arg == (uintptr_t) a && ev.ptr == (uintptr_t) c);
+        printf("%s %llu %llu\n", names[ev.op], (unsigned long long) ev.size,
+               ev.op == M61_TRACE_REALLOC ? 0 : (unsigned long long) ev.arg);
+    }
+    fclose(f);
+    remove(filename);
+}
+
+//! malloc 100 0
+//! calloc 20 10
+//! realloc 200 0
+//! aligned 64 64
+//! free 0 0
+//! free 0 0
+//! free 0 0
@@ -0,0 +1,45 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+// Calloc clears reused slab slots and guard spans, and rejects sizes that
+// overflow.
+
+static int all_zero(const char* p, size_t sz) {
+    for (size_t i = 0; i < sz; ++i)
+        if (p[i])
+            return 0;
+    return 1;
+}
+
+int main() {
+    slab_enablealloc(1);
+    guard_setthreshold(8192);
+    for (int round = 0; round < 3; ++round) {
+        char* small[100];
+        char* large[4];
+        for (int i = 0; i < 100; ++i) {
+            small[i] = (char*) calloc(i + 1, 8);
+            assert(small[i] && all_zero(small[i], (i + 1) * 8));
+            memset(small[i], 0xAA, (i + 1) * 8);
+        }
+        for (int i = 0; i < 4; ++i) {
+            large[i] = (char*) calloc(1000, 10 + i);
+            assert(large[i] && all_zero(large[i], 1000 * (10 + i)));
+            memset(large[i], 0xAA, 1000 * (10 + i));
+        }
+        for (int i = 0; i < 100; ++i)
+            free(small[i]);
+        for (int i = 0; i < 4; ++i)
+            free(large[i]);
+    }
+
+    assert(calloc(SIZE_MAX / 2 + 1, 2) == NULL);
+    assert(calloc(2, SIZE_MAX / 2 + 1) == NULL);
+    assert(calloc((size_t) 1 << 32, (size_t) 1 << 32) == NULL);
+    m61_printstatistics();
+}
+
+//! malloc count: active          0   total        312   fail          3
+//! malloc size:  active          0   total     259200   fail ???
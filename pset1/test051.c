@@ -0,0 +1,41 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Fragmentation of slab blocks.
+
+int main() {
+    slab_enablealloc(1);
+    // 40-byte payloads take 64-byte slots (16-byte header, 4-byte tail)
+    char* ptrs[256];
+    for (int i = 0; i < 256; ++i)
+        ptrs[i] = (char*) malloc(40);
+    // free every other block
+    for (int i = 0; i < 256; i += 2)
+        free(ptrs[i]);
+
+    struct m61_fragmentation frag;
+    m61_getfragmentation(&frag, 1000);
+    printf("blocks %llu, live %llu, footprint %llu, regions %llu\n",
+           frag.nblocks, frag.live_bytes, frag.footprint_bytes, frag.nregions);
+    printf("holes %llu, hole bytes %llu, 8-15 byte holes %llu, 64-127 byte holes %llu\n",
+           frag.nholes, frag.hole_bytes, frag.hole_hist[4], frag.hole_hist[7]);
+    printf("pages %llu, used %llu, half-full pages %llu\n",
+           frag.npages, frag.npages_used, frag.occupancy_hist[4]);
+    assert(frag.nregions == 1 && !frag.truncated);
+
+    // a bounded walk stops early
+    m61_getfragmentation(&frag, 10);
+    printf("blocks %llu, truncated %d\n", frag.nblocks, frag.truncated);
+
+    for (int i = 1; i < 256; i += 2)
+        free(ptrs[i]);
+    m61_getfragmentation(&frag, 1000);
+    printf("blocks %llu, pages %llu\n", frag.nblocks, frag.npages);
+}
+
+//! blocks 128, live 5120, footprint 7680, regions 1
+//! holes 127, hole bytes 8636, 8-15 byte holes 0, 64-127 byte holes 127
+//! pages 4, used 4, half-full pages 4
+//! blocks 10, truncated 1
+//! blocks 0, pages 0
@@ -0,0 +1,41 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <math.h>
+// Sampling mode: unbiased per-site estimates, exact statistics.
+
+static char* small[100000];
+static char* large[1000];
+
+int main() {
+    slab_enablealloc(1);
+    m61_setsampling(4096);
+    for (int i = 0; i < 100000; ++i)
+        small[i] = (char*) malloc(64);          // 6400000 bytes
+    for (int i = 0; i < 1000; ++i)
+        large[i] = (char*) malloc(6400);        // 6400000 bytes
+    for (int i = 0; i < 100000; ++i)
+        small[i] = (char*) realloc(small[i], 32);
+
+    // blocks much bigger than the interval are always sampled
+    char* huge = (char*) malloc(1 << 20);
+    assert(((struct m61_statistics_metadata*) huge - 1)->deadbeef == 0x0CAFEBABE);
+    free(huge);
+
+    m61_printleaksummary();
+    m61_printstatistics();
+    for (int i = 0; i < 100000; ++i)
+        free(small[i]);
+    for (int i = 0; i < 1000; ++i)
+        free(large[i]);
+    m61_printstatistics();
+}
+
+//! LEAK SUMMARY: test???.c:17: ??{[56][0-9]{6}}?? bytes in ??{1[0-9]{3}|9[0-9]{2}}?? objects
+//! LEAK SUMMARY: test???.c:19: ??{[23][0-9]{6}}?? bytes in ??{1[01][0-9]{4}|[89][0-9]{4}}?? objects
+//! LEAK SUMMARY: total ??{[89][0-9]{6}|10[0-9]{6}}?? bytes in ??{1[01][0-9]{4}|[89][0-9]{4}}?? objects from 2 sites
+//! malloc count: active     101000   total     201001   fail          0
+//! malloc size:  active    9600000   total   17048576   fail          0
+//! malloc count: active          0   total     201001   fail          0
+//! malloc size:  active          0   total   17048576   fail          0
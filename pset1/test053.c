@@ -0,0 +1,37 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+// A forked child reports only its own leaks at exit.
+
+int main() {
+    m61_setleakcheck(1);
+    char* a = (char*) malloc(10);
+    char* b = (char*) malloc(20);
+    printf("before fork\n");            // printed once: flushed at fork
+
+    pid_t p = fork();
+    assert(p >= 0);
+    if (p == 0) {
+        char* c = (char*) malloc(30);
+        free(a);                        // inherited blocks can be freed
+        (void) c;
+        m61_printstatistics();
+        exit(0);
+    }
+    waitpid(p, NULL, 0);
+    printf("parent\n");
+    free(b);
+    m61_printstatistics();
+}
+
+//! before fork
+//! malloc count: active          2   total          3   fail          0
+//! malloc size:  active         50   total         60   fail          0
+//! LEAK CHECK: test???.c:18: allocated object ??{0x[0-9a-f]+}?? with size 30
+//! parent
+//! malloc count: active          1   total          2   fail          0
+//! malloc size:  active         10   total         30   fail          0
+//! LEAK CHECK: test???.c:11: allocated object ??{0x[0-9a-f]+}?? with size 10
@@ -0,0 +1,40 @@
+#include "m61.h"
+#include <stdio.h>
+// Call stacks tell apart blocks allocated through one wrapper.
+
+static char* __attribute__((noinline)) make(size_t sz) {
+    char* p = (char*) malloc(sz);
+    p[0] = 1;
+    return p;
+}
+
+static char* __attribute__((noinline)) from_a(void) {
+    char* p = make(100);
+    p[1] = 2;
+    return p;
+}
+
+static char* __attribute__((noinline)) from_b(void) {
+    char* p = make(500);
+    p[1] = 3;
+    return p;
+}
+
+int main() {
+    m61_setstackdepth(1);
+    for (int i = 0; i < 3; ++i)
+        from_a();
+    from_b();
+    m61_printleaksummary();
+    m61_printheavyreport();
+}
+
+//! LEAK SUMMARY: test???.c:6: 500 bytes in 1 objects
+//!     at ???
+//! LEAK SUMMARY: test???.c:6: 300 bytes in 3 objects
+//!     at ???
+//! LEAK SUMMARY: total 800 bytes in 4 objects from 2 sites
+//! HEAVY HITTER: test???.c:6: 500 bytes (~62.5%) in 1 allocations
+//!     at ???
+//! HEAVY HITTER: test???.c:6: 300 bytes (~37.5%) in 3 allocations
+//!     at ???
@@ -0,0 +1,33 @@
+#include "m61.h"
+#include <stdio.h>
+// Snapshots show which sites grew between two points.
+
+static char* kept[100];
+
+int main() {
+    char* old = (char*) malloc(1000);
+    struct m61_snapshot* a = m61_snapshot();
+    for (int i = 0; i < 100; ++i) {
+        kept[i] = (char*) malloc(24);           // slow leak
+        char* tmp = (char*) malloc(500);        // transient
+        free(tmp);
+    }
+    char* big = (char*) malloc(3000);
+    free(old);
+    struct m61_snapshot* b = m61_snapshot();
+    m61_snapshot_diff(a, b);
+    m61_snapshot_diff(NULL, a);
+    m61_snapshot_diff(b, b);
+    m61_snapshot_free(a);
+    m61_snapshot_free(b);
+    free(big);
+    for (int i = 0; i < 100; ++i)
+        free(kept[i]);
+}
+
+//! SNAPSHOT DIFF: test???.c:15: +3000 bytes in +1 objects (now 3000 bytes in 1 objects)
+//! SNAPSHOT DIFF: test???.c:11: +2400 bytes in +100 objects (now 2400 bytes in 100 objects)
+//! SNAPSHOT DIFF: total +4400 bytes in +100 objects, 2 sites grew
+//! SNAPSHOT DIFF: test???.c:8: +1000 bytes in +1 objects (now 1000 bytes in 1 objects)
+//! SNAPSHOT DIFF: total +1000 bytes in +1 objects, 1 sites grew
+//! SNAPSHOT DIFF: total +0 bytes in +0 objects, 0 sites grew
@@ -0,0 +1,25 @@
+#include "m61.h"
+#include <stdio.h>
+// The incremental heap checker finds a wild write to a long-lived block.
+
+static char* blocks[100];
+
+int main() {
+    for (int i = 0; i < 100; ++i)
+        blocks[i] = (char*) malloc(i + 1);
+
+    // a clean heap passes, a few blocks per call
+    int calls = 1;
+    while (!m61_check_heap_step(8))
+        ++calls;
+    printf("clean pass in %s calls\n", calls >= 100 / 8 ? "enough" : "too few");
+
+    blocks[42][43] = 'X';
+    for (int i = 0; i < 1000; ++i)
+        m61_check_heap_step(8);
+    printf("not detected\n");
+}
+
+//! clean pass in enough calls
+//! MEMORY BUG: test???.c:9: detected wild write to active block ??{0x[0-9a-f]+}?? with size 43
+//! ???
@@ -0,0 +1,39 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+// Peak active blocks and bytes, overall and by size.
+
+static char* ptrs[100];
+
+int main() {
+    for (int i = 0; i < 100; ++i)
+        ptrs[i] = (char*) malloc(10);           // bucket 8-15
+    char* big = (char*) malloc(1000);           // bucket 512-1023
+    free(big);
+    for (int i = 0; i < 100; ++i)
+        free(ptrs[i]);
+    for (int i = 0; i < 50; ++i)
+        ptrs[i] = (char*) malloc(20);           // bucket 16-31
+    ptrs[0] = (char*) realloc(ptrs[0], 2000);   // bucket 1024-2047
+
+    struct m61_statistics stats;
+    m61_getstatistics(&stats);
+    printf("active %llu/%llu, peak %llu/%llu\n", stats.nactive,
+           stats.active_size, stats.peak_nactive, stats.peak_active_size);
+    assert(stats.peak_time_ms < 10000);
+
+    unsigned long long peak[M61_NSIZEBUCKETS];
+    m61_getsizepeaks(peak);
+    for (int b = 0; b < M61_NSIZEBUCKETS; ++b)
+        if (peak[b])
+            printf("bucket %d: %llu\n", b, peak[b]);
+
+    for (int i = 0; i < 50; ++i)
+        free(ptrs[i]);
+}
+
+//! active 50/2980, peak 101/3000
+//! bucket 4: 100
+//! bucket 5: 50
+//! bucket 10: 1
+//! bucket 11: 1
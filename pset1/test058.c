@@ -0,0 +1,25 @@
+#include "m61.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+// A failed realloc leaves the old block allocated and unchanged.
+
+int main() {
+    char* p = (char*) malloc(10);
+    strcpy(p, "hello");
+    char* q = (char*) realloc(p, SIZE_MAX - 8);
+    printf("%s %s\n", q ? "non-null" : "null", p);
+    struct m61_statistics stats;
+    m61_getstatistics(&stats);
+    printf("reallocs %llu\n", stats.nrealloc);
+    m61_printstatistics();
+    free(p);
+    m61_printstatistics();
+}
+
+//! null hello
+//! reallocs 0
+//! malloc count: active          1   total          1   fail          1
+//! malloc size:  active         10   total         10   fail ??{\d+}??
+//! malloc count: active          0   total          1   fail          1
+//! malloc size:  active          0   total         10   fail ??{\d+}??
@@ -0,0 +1,14 @@
+#include "m61.h"
+#include <stdio.h>
+// Wild free into a guard page is reported, not a crash.
+
+int main() {
+    guard_setthreshold(4096);
+    char* lo = (char*) malloc(10000);
+    char* hi = (char*) malloc(10000);
+    (void) hi;
+    free(lo + 12288 + 64);
+}
+
+//! MEMORY BUG???: invalid free of pointer ???, not allocated
+//! ???
@@ -0,0 +1,25 @@
+#include "m61.h"
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+// Double free of a guarded block is caught after its span is dropped.
+
+int main() {
+    guard_setthreshold(4096);
+    char* ptrs[80];
+    for (int i = 0; i < 80; ++i) {
+        ptrs[i] = (char*) malloc(1 << 20);
+        memset(ptrs[i], 'x', 1 << 20);
+    }
+    for (int i = 0; i < 80; ++i)
+        free(ptrs[i]);
+    // a reused dropped span, kept header page included, is zero
+    char* p = (char*) calloc(1, 1 << 20);
+    for (int i = 0; i < (1 << 20); ++i)
+        assert(p[i] == 0);
+    free(p);
+    free(ptrs[70]);
+}
+
+//! MEMORY BUG???: invalid free of pointer ???, double free ya dingus
+//! ???
@@ -0,0 +1,18 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <limits.h>
+// Failed bytes saturate instead of wrapping.
+
+int main() {
+    assert(calloc((size_t) -1 / 8 + 2, 16) == NULL);
+    assert(calloc((size_t) -1 / 8 + 2, 16) == NULL);
+    assert(malloc((size_t) -1 - 100) == NULL);
+    struct m61_statistics stats;
+    m61_getstatistics(&stats);
+    assert(stats.fail_size == ULLONG_MAX);
+    m61_printstatistics();
+}
+
+//! malloc count: active          0   total          0   fail          3
+//! malloc size:  active          0   total          0   fail 18446744073709551615
@@ -0,0 +1,49 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <pthread.h>
+#include <semaphore.h>
+// Peaks are not overcounted from other threads' unfolded frees.
+
+static sem_t worked, done;
+static void* ptrs[64];
+
+static void* worker(void* arg) {
+    (void) arg;
+    for (int i = 0; i < 64; ++i)
+        ptrs[i] = malloc(8);
+    for (int i = 1; i < 64; ++i)
+        free(ptrs[i]);
+    sem_post(&worked);
+    sem_wait(&done);            // stay alive while main allocates
+    return NULL;
+}
+
+int main() {
+    sem_init(&worked, 0, 0);
+    sem_init(&done, 0, 0);
+    pthread_t t;
+    pthread_create(&t, NULL, worker, NULL);
+    sem_wait(&worked);
+    free(ptrs[0]);
+    void* mine[10];
+    for (int i = 0; i < 10; ++i)
+        mine[i] = malloc(8);
+    struct m61_statistics stats;
+    m61_getstatistics(&stats);
+    printf("peak while worker lives: %llu\n", stats.peak_nactive);
+
+    sem_post(&done);
+    pthread_join(t, NULL);
+    for (int i = 0; i < 10; ++i)
+        free(mine[i]);
+    for (int i = 0; i < 10; ++i)
+        mine[i] = malloc(8);
+    m61_getstatistics(&stats);
+    printf("peak after worker exits: %llu\n", stats.peak_nactive);
+    for (int i = 0; i < 10; ++i)
+        free(mine[i]);
+}
+
+//! peak while worker lives: 64
+//! peak after worker exits: 64
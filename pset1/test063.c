@@ -0,0 +1,14 @@
+#include "m61.h"
+#include <stdio.h>
+#include <string.h>
+// The heap checker reports an overwritten header without trusting it.
+
+int main() {
+    char* p = (char*) malloc(100);
+    memset(p - 16, 'A', 16);
+    while (!m61_check_heap_step(8)) {
+    }
+}
+
+//! MEMORY BUG: detected wild write to the header of active block ???
+//! ???
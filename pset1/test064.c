@@ -0,0 +1,14 @@
+#include "m61.h"
+#include <stdio.h>
+#include <string.h>
+// The heap checker reports a wild size field without following it.
+
+int main() {
+    char* p = (char*) malloc(100);
+    memset(p - 8, 'A', 8);
+    while (!m61_check_heap_step(8)) {
+    }
+}
+
+//! MEMORY BUG: detected wild write to the header of active block ???
+//! ???
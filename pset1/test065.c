@@ -0,0 +1,30 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+// Shrinking a guard-page block keeps its end at the guard page.
+
+int main() {
+    guard_setthreshold(4096);
+    char* p = (char*) malloc(20000);
+    char* q = (char*) realloc(p, 6000);
+    assert(guard_usable_size(q - 16) <= 16 + 6000 + 4 + 15);
+
+    pid_t child = fork();
+    if (child == 0) {
+        q[6000 + 32] = 'X';     // past the tail and slack
+        _exit(0);
+    }
+    int status;
+    waitpid(child, &status, 0);
+    printf("overflow %s\n", WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV
+           ? "faults" : "does not fault");
+    free(q);
+    m61_printstatistics();
+}
+
+//! overflow faults
+//! malloc count: active          0   total          2   fail          0
+//! malloc size:  active          0   total      26000   fail          0